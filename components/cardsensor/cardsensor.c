@@ -0,0 +1,207 @@
+#include "sdkconfig.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "driver/gpio.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "cardsensor.h"
+#include "debounce.h"
+
+static const char *TAG = "cardsensor"; //for log
+
+static const gpio_num_t drive_pin = CONFIG_CARDSENSOR_DRIVE_GPIO;
+static const gpio_num_t read_pin = CONFIG_CARDSENSOR_READ_GPIO;
+
+static TaskHandle_t notify_task;
+static debounce_t debounce;
+static portMUX_TYPE debounce_lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t inserted_edge_us;
+
+static void notify(debounce_event_t event) {
+    if (event == DEBOUNCE_INSERTED) {
+        xTaskNotify(notify_task, CARDSENSOR_NOTIFY_INSERTED, eSetBits);
+    } else if (event == DEBOUNCE_REMOVED) {
+        xTaskNotify(notify_task, CARDSENSOR_NOTIFY_REMOVED, eSetBits);
+    }
+}
+
+// Feed a sensor reading from a timer callback
+static void feed(bool level) {
+    debounce_event_t event;
+    portENTER_CRITICAL(&debounce_lock);
+    event = debounce_update(&debounce, level, esp_timer_get_time());
+    if (event == DEBOUNCE_INSERTED) {
+        inserted_edge_us = debounce.since_us;
+    }
+    portEXIT_CRITICAL(&debounce_lock);
+    notify(event);
+}
+
+#if CONFIG_CARDSENSOR_MODE_TIMER
+/*
+ * Modulated emitter
+ *
+ * The timer runs at twice the sample rate: one tick switches the emitter
+ * on, the next reads the sensor and switches it off again.
+ */
+
+static esp_timer_handle_t sample_timer;
+static bool emitter_on;
+
+static void sample_cb(void *arg) {
+    if (!emitter_on) {
+        gpio_set_level(drive_pin, 1);
+        emitter_on = true;
+        return;
+    }
+    int level = gpio_get_level(read_pin);
+    gpio_set_level(drive_pin, 0);
+    emitter_on = false;
+    feed(level == 1);
+}
+
+static esp_err_t start_sensing(void) {
+    const esp_timer_create_args_t args = {
+        .callback = sample_cb,
+        .name = "cardsensor",
+    };
+    esp_err_t err = esp_timer_create(&args, &sample_timer);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return esp_timer_start_periodic(sample_timer, CONFIG_CARDSENSOR_SAMPLE_PERIOD_US / 2);
+}
+
+#else
+/*
+ * Edge interrupts
+ *
+ * Each edge restarts a one-shot timer that reads the sensor again once the
+ * level could have been stable for the debounce time; bounces keep pushing
+ * it back. Timers cannot be started from the ISR, so that goes through the
+ * timer service task. The ISR only records the edge: the debounced state
+ * changes in feed, which sends the notification, so no change goes
+ * unreported.
+ *
+ * Only one call is pending in the timer queue at a time: a burst of
+ * bounces is handled by the one call, which reads the latest edge. If the
+ * queue is full, the next edge, or a confirm timer already running, tries
+ * again.
+ */
+
+static esp_timer_handle_t confirm_timer;
+static bool arm_pending;
+static uint32_t arm_failures;
+
+// Restart the confirm timer for the current deadline, if any
+static void start_confirm(void) {
+    int64_t deadline;
+    portENTER_CRITICAL(&debounce_lock);
+    deadline = debounce_deadline(&debounce);
+    portEXIT_CRITICAL(&debounce_lock);
+    esp_timer_stop(confirm_timer);
+    if (deadline >= 0) {
+        int64_t delay = deadline - esp_timer_get_time();
+        esp_timer_start_once(confirm_timer, delay > 0 ? delay : 0);
+    }
+}
+
+static void confirm_cb(void *arg) {
+    feed(gpio_get_level(read_pin) == 1);
+    // The level may have moved again without an edge being caught
+    start_confirm();
+}
+
+static void arm_confirm(void *arg, uint32_t unused) {
+    uint32_t failures;
+    // Cleared before the deadline is read, so a later edge pends again
+    portENTER_CRITICAL(&debounce_lock);
+    arm_pending = false;
+    failures = arm_failures;
+    arm_failures = 0;
+    portEXIT_CRITICAL(&debounce_lock);
+    if (failures) {
+        ESP_LOGW(TAG, "Timer queue full on %u edges", (unsigned)failures);
+    }
+    start_confirm();
+}
+
+static void IRAM_ATTR edge_isr(void *arg) {
+    BaseType_t woken = pdFALSE;
+    bool pend;
+    portENTER_CRITICAL_ISR(&debounce_lock);
+    debounce_edge(&debounce, gpio_get_level(read_pin) == 1, esp_timer_get_time());
+    pend = !arm_pending;
+    arm_pending = true;
+    portEXIT_CRITICAL_ISR(&debounce_lock);
+    if (pend && xTimerPendFunctionCallFromISR(arm_confirm, NULL, 0, &woken) != pdPASS) {
+        portENTER_CRITICAL_ISR(&debounce_lock);
+        arm_pending = false;
+        arm_failures++;
+        portEXIT_CRITICAL_ISR(&debounce_lock);
+    }
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+static esp_err_t start_sensing(void) {
+    const esp_timer_create_args_t args = {
+        .callback = confirm_cb,
+        .name = "cardsensor",
+    };
+    esp_err_t err = esp_timer_create(&args, &confirm_timer);
+    if (err != ESP_OK) {
+        return err;
+    }
+    gpio_set_level(drive_pin, 1);
+    gpio_set_intr_type(read_pin, GPIO_INTR_ANYEDGE);
+    err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        // ESP_ERR_INVALID_STATE: already installed by someone else
+        return err;
+    }
+    err = gpio_isr_handler_add(read_pin, edge_isr, NULL);
+    if (err != ESP_OK) {
+        return err;
+    }
+    // A card may already be in place, with no edge to report it
+    feed(gpio_get_level(read_pin) == 1);
+    start_confirm();
+    return ESP_OK;
+}
+#endif
+
+esp_err_t cardsensor_start(TaskHandle_t task) {
+    notify_task = task;
+    debounce_init(&debounce, CONFIG_CARDSENSOR_DEBOUNCE_MS * 1000LL, esp_timer_get_time());
+
+    gpio_reset_pin(read_pin);
+    gpio_set_direction(read_pin, GPIO_MODE_INPUT);
+    gpio_reset_pin(drive_pin);
+    gpio_set_direction(drive_pin, GPIO_MODE_OUTPUT);
+    gpio_set_drive_capability(drive_pin, GPIO_DRIVE_CAP_0); //~10mA
+
+    esp_err_t err = start_sensing();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Could not start sensing: %s", esp_err_to_name(err));
+    } else {
+        ESP_LOGI(TAG, "Sensing, debounce %d ms", CONFIG_CARDSENSOR_DEBOUNCE_MS);
+    }
+    return err;
+}
+
+bool cardsensor_present(void) {
+    return debounce.present;
+}
+
+int64_t cardsensor_inserted_us(void) {
+    int64_t us;
+    portENTER_CRITICAL(&debounce_lock);
+    us = inserted_edge_us;
+    portEXIT_CRITICAL(&debounce_lock);
+    return us;
+}
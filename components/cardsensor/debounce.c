@@ -0,0 +1,38 @@
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#else
+#define IRAM_ATTR
+#endif
+
+#include "debounce.h"
+
+void debounce_init(debounce_t *d, int64_t stable_us, int64_t now_us) {
+    d->stable_us = stable_us;
+    d->present = false;
+    d->level = false;
+    d->since_us = now_us;
+}
+
+// Called from the edge interrupt
+void IRAM_ATTR debounce_edge(debounce_t *d, bool level, int64_t now_us) {
+    if (level != d->level) {
+        d->level = level;
+        d->since_us = now_us;
+    }
+}
+
+debounce_event_t debounce_update(debounce_t *d, bool level, int64_t now_us) {
+    debounce_edge(d, level, now_us);
+    if (d->level == d->present || now_us - d->since_us < d->stable_us) {
+        return DEBOUNCE_NONE;
+    }
+    d->present = d->level;
+    return d->present ? DEBOUNCE_INSERTED : DEBOUNCE_REMOVED;
+}
+
+int64_t debounce_deadline(const debounce_t *d) {
+    if (d->level == d->present) {
+        return -1;
+    }
+    return d->since_us + d->stable_us;
+}
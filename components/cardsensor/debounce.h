@@ -0,0 +1,39 @@
+#ifndef __TANGIBLE_DEBOUNCE_H__
+#define __TANGIBLE_DEBOUNCE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Debounce state machine of the card sensor. It depends on nothing but the
+// levels and timestamps fed to it, so that edge timelines can be replayed
+// against it on a host.
+
+typedef enum {
+    DEBOUNCE_NONE,
+    DEBOUNCE_INSERTED,
+    DEBOUNCE_REMOVED,
+} debounce_event_t;
+
+typedef struct {
+    int64_t stable_us;
+    bool present;       // debounced state
+    bool level;         // last raw level
+    int64_t since_us;   // time the raw level last changed
+} debounce_t;
+
+// Start with no card and the raw level low at now_us
+void debounce_init(debounce_t *d, int64_t stable_us, int64_t now_us);
+
+// Record the raw level at now_us, e.g. on an edge, without changing the
+// debounced state; the next debounce_update does that. Safe in an ISR.
+void debounce_edge(debounce_t *d, bool level, int64_t now_us);
+
+// Feed the raw level at now_us, from a sample or a confirming read. Returns
+// the event if the debounced state changed.
+debounce_event_t debounce_update(debounce_t *d, bool level, int64_t now_us);
+
+// Time at which the current raw level will have been stable long enough to
+// change the debounced state, or -1 if it already matches
+int64_t debounce_deadline(const debounce_t *d);
+
+#endif
@@ -0,0 +1,86 @@
+#include <assert.h>
+#include <stdio.h>
+
+#include "debounce.h"
+
+#define MS 1000LL
+#define STABLE (50 * MS)
+
+static void test_insert_remove(void) {
+    debounce_t d;
+
+    debounce_init(&d, STABLE, 0);
+    assert(!d.present && debounce_deadline(&d) == -1);
+
+    // Not before the level has been stable for the whole debounce time
+    assert(debounce_update(&d, true, 10 * MS) == DEBOUNCE_NONE);
+    assert(debounce_deadline(&d) == 60 * MS);
+    assert(debounce_update(&d, true, 60 * MS - 1) == DEBOUNCE_NONE);
+    assert(!d.present);
+    assert(debounce_update(&d, true, 60 * MS) == DEBOUNCE_INSERTED);
+    assert(d.present && d.since_us == 10 * MS);
+    assert(debounce_deadline(&d) == -1);
+
+    // Reported once
+    assert(debounce_update(&d, true, 500 * MS) == DEBOUNCE_NONE);
+
+    assert(debounce_update(&d, false, 600 * MS) == DEBOUNCE_NONE);
+    assert(debounce_update(&d, false, 650 * MS) == DEBOUNCE_REMOVED);
+    assert(!d.present);
+}
+
+static void test_bounces(void) {
+    debounce_t d;
+
+    debounce_init(&d, STABLE, 0);
+    // Each bounce restarts the wait
+    assert(debounce_update(&d, true, 0) == DEBOUNCE_NONE);
+    assert(debounce_update(&d, false, 20 * MS) == DEBOUNCE_NONE);
+    assert(debounce_update(&d, true, 40 * MS) == DEBOUNCE_NONE);
+    assert(debounce_deadline(&d) == 90 * MS);
+    assert(debounce_update(&d, true, 89 * MS) == DEBOUNCE_NONE);
+    assert(debounce_update(&d, true, 90 * MS) == DEBOUNCE_INSERTED);
+
+    // A dropout shorter than the debounce time is no removal
+    assert(debounce_update(&d, false, 200 * MS) == DEBOUNCE_NONE);
+    assert(debounce_deadline(&d) == 250 * MS);
+    assert(debounce_update(&d, true, 230 * MS) == DEBOUNCE_NONE);
+    assert(debounce_deadline(&d) == -1);
+    assert(debounce_update(&d, true, 400 * MS) == DEBOUNCE_NONE);
+    assert(d.present);
+}
+
+// The edge interrupt only records edges; the confirming read commits them
+static void test_edges(void) {
+    debounce_t d;
+
+    debounce_init(&d, STABLE, 0);
+    debounce_edge(&d, true, 10 * MS);
+    assert(debounce_deadline(&d) == 60 * MS);
+    // Repeated levels, e.g. edges too close to read apart, keep the first time
+    debounce_edge(&d, true, 30 * MS);
+    assert(debounce_deadline(&d) == 60 * MS);
+    // Past the deadline, but still only the confirming read reports it
+    debounce_edge(&d, true, 100 * MS);
+    assert(!d.present);
+    assert(debounce_update(&d, true, 100 * MS) == DEBOUNCE_INSERTED);
+    assert(d.since_us == 10 * MS);
+
+    // Card pulled and put back between two reads: nothing to report
+    debounce_edge(&d, false, 200 * MS);
+    debounce_edge(&d, true, 220 * MS);
+    assert(debounce_deadline(&d) == -1);
+    assert(debounce_update(&d, true, 300 * MS) == DEBOUNCE_NONE);
+
+    // An edge missed altogether is caught by the confirming read
+    assert(debounce_update(&d, false, 400 * MS) == DEBOUNCE_NONE);
+    assert(debounce_update(&d, false, 450 * MS) == DEBOUNCE_REMOVED);
+}
+
+int main(void) {
+    test_insert_remove();
+    test_bounces();
+    test_edges();
+    printf("test_debounce: ok\n");
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef __TANGIBLE_CARDSENSOR_H__
+#define __TANGIBLE_CARDSENSOR_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Photo sensor card detection, see the "Card sensor" menu.
+//
+// The sensor is sampled from a timer or interrupt rather than polled by the
+// application, debounced, and each insert or remove is sent to a task as a
+// notification bit, so the reader task sleeps until something happens.
+
+// Notification bits, set with eSetBits
+#define CARDSENSOR_NOTIFY_INSERTED (1 << 0)
+#define CARDSENSOR_NOTIFY_REMOVED  (1 << 1)
+
+// Configure the sensor pins and start sensing; events go to task. A card
+// already in place is reported as inserted once debounced.
+esp_err_t cardsensor_start(TaskHandle_t task);
+
+// Debounced state
+bool cardsensor_present(void);
+
+// Time of the sensor edge that started the last insert, before
+// debouncing, as esp_timer_get_time(); 0 before the first
+int64_t cardsensor_inserted_us(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,88 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "latency.h"
+
+static latency_hist_t hist;
+
+// Value reported for a bucket: that of a histogram of one sample
+static uint32_t single(uint32_t us) {
+    latency_hist_t one;
+    memset(&one, 0, sizeof(one));
+    latency_add(&one, us);
+    return latency_percentile(&one, 50);
+}
+
+// Within half a bucket, 1/16 of the value, everywhere below the maximum
+static void test_buckets(void) {
+    uint32_t us;
+    uint32_t last = 0;
+
+    assert(LATENCY_BUCKETS == 200);
+    for (us = 0; us < 16; us++) {
+        assert(single(us) == us);
+    }
+    for (us = 16; us < 1u << LATENCY_MAX_BITS; us += us / 64 + 1) {
+        uint32_t value = single(us);
+        uint32_t error = value > us ? value - us : us - value;
+        assert(error <= us / 16);
+        // Never out of order
+        assert(value >= last);
+        last = value;
+    }
+    // Power of two boundaries start a new row of buckets
+    assert(single(1023) < single(1024));
+    assert(single(1024) == 1024 + 64);
+
+    // Longer ones all land in the last bucket
+    us = single((1u << LATENCY_MAX_BITS) - 1);
+    assert(single(1u << LATENCY_MAX_BITS) == us);
+    assert(single(UINT32_MAX) == us);
+}
+
+static void test_percentiles(void) {
+    int i;
+
+    memset(&hist, 0, sizeof(hist));
+    assert(latency_percentile(&hist, 50) == 0);
+
+    // 1 ms .. 100 ms, in 1 ms steps, in reverse order
+    for (i = 100; i >= 1; i--) {
+        latency_add(&hist, i * 1000);
+    }
+    assert(hist.total == 100);
+    // Rank rounded up: p50 is the 50th sample, p0 the first
+    assert(latency_percentile(&hist, 50) == single(50000));
+    assert(latency_percentile(&hist, 99) == single(99000));
+    assert(latency_percentile(&hist, 100) == single(100000));
+    assert(latency_percentile(&hist, 0) == single(1000));
+    assert(latency_percentile(&hist, 1) == single(1000));
+    assert(latency_percentile(&hist, 2) == single(2000));
+}
+
+static void test_saturation(void) {
+    uint32_t i;
+
+    // Three times what a bucket holds, then a slow fifth
+    memset(&hist, 0, sizeof(hist));
+    for (i = 0; i < 3 * UINT16_MAX; i++) {
+        latency_add(&hist, 2000);
+    }
+    for (i = 0; i < UINT16_MAX / 4; i++) {
+        latency_add(&hist, 40000);
+    }
+    // Halved rather than wrapped around, so the shape is kept
+    assert(hist.total < 2 * UINT16_MAX);
+    assert(latency_percentile(&hist, 50) == single(2000));
+    assert(latency_percentile(&hist, 75) == single(2000));
+    assert(latency_percentile(&hist, 90) == single(40000));
+}
+
+int main(void) {
+    test_buckets();
+    test_percentiles();
+    test_saturation();
+    printf("test_latency: ok\n");
+    return 0;
+}
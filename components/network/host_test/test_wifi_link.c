@@ -0,0 +1,170 @@
+#include <assert.h>
+#include <stdio.h>
+
+#include "wifi_link.h"
+
+#define MS 1000LL
+
+static const wifi_link_config_t config = {
+    .backoff_min_ms = 500,
+    .backoff_max_ms = 60000,
+    .weak_rssi = -75,
+};
+
+static wifi_link_action_t handle(wifi_link_t *link, wifi_link_event_type_t type,
+                                 int64_t now_us, int value) {
+    wifi_link_event_t event = {
+        .type = type,
+        .now_us = now_us,
+        .reason = value,
+        .rssi = value,
+    };
+    return wifi_link_handle(link, &event);
+}
+
+// Upper end of the n-th wait: min * 2^(n-1), capped at max
+static uint32_t backoff_limit(uint32_t n) {
+    uint32_t limit = config.backoff_min_ms;
+    while (--n && limit < config.backoff_max_ms) {
+        limit *= 2;
+    }
+    return limit < config.backoff_max_ms ? limit : config.backoff_max_ms;
+}
+
+static void test_backoff_growth(void) {
+    wifi_link_t link;
+    uint32_t seed;
+    uint32_t n;
+
+    for (seed = 0; seed < 100; seed++) {
+        wifi_link_init(&link, &config, seed);
+        assert(handle(&link, WIFI_LINK_EV_START, 0, 0) == WIFI_LINK_ACTION_CONNECT);
+        for (n = 1; n <= 20; n++) {
+            uint32_t limit = backoff_limit(n);
+            assert(handle(&link, WIFI_LINK_EV_DISCONNECTED, 0, 201) == WIFI_LINK_ACTION_WAIT);
+            assert(link.state == WIFI_LINK_BACKOFF && link.failures == n);
+            // Upper half of the limit, never past the cap
+            assert(link.retry_in_ms >= limit - limit / 2);
+            assert(link.retry_in_ms <= limit);
+            assert(link.retry_in_ms <= config.backoff_max_ms);
+            // Nothing to do until the timer fires
+            assert(handle(&link, WIFI_LINK_EV_DISCONNECTED, 0, 201) == WIFI_LINK_ACTION_NONE);
+            assert(handle(&link, WIFI_LINK_EV_TIMER, 0, 0) == WIFI_LINK_ACTION_CONNECT);
+            assert(link.state == WIFI_LINK_CONNECTING);
+        }
+    }
+    assert(backoff_limit(1) == 500 && backoff_limit(7) == 32000);
+    assert(backoff_limit(8) == 60000 && backoff_limit(20) == 60000);
+}
+
+static void test_jitter(void) {
+    wifi_link_t link;
+    uint32_t lowest = UINT32_MAX, highest = 0;
+    uint32_t first[2];
+    uint32_t seed;
+
+    // Devices started together spread over the whole upper half
+    for (seed = 1; seed <= 1000; seed++) {
+        wifi_link_init(&link, &config, seed);
+        handle(&link, WIFI_LINK_EV_START, 0, 0);
+        handle(&link, WIFI_LINK_EV_DISCONNECTED, 0, 201);
+        if (link.retry_in_ms < lowest) {
+            lowest = link.retry_in_ms;
+        }
+        if (link.retry_in_ms > highest) {
+            highest = link.retry_in_ms;
+        }
+    }
+    assert(lowest >= 250 && lowest < 260);
+    assert(highest <= 500 && highest > 490);
+
+    // The same seed gives the same waits
+    for (seed = 0; seed < 2; seed++) {
+        wifi_link_init(&link, &config, 42);
+        handle(&link, WIFI_LINK_EV_START, 0, 0);
+        handle(&link, WIFI_LINK_EV_DISCONNECTED, 0, 201);
+        first[seed] = link.retry_in_ms;
+    }
+    assert(first[0] == first[1]);
+}
+
+static void test_reconnect(void) {
+    wifi_link_t link;
+
+    wifi_link_init(&link, &config, 7);
+    assert(!wifi_link_is_up(&link));
+    // Not started: disconnects and timers are ignored
+    assert(handle(&link, WIFI_LINK_EV_DISCONNECTED, 0, 201) == WIFI_LINK_ACTION_NONE);
+    assert(handle(&link, WIFI_LINK_EV_TIMER, 0, 0) == WIFI_LINK_ACTION_NONE);
+
+    handle(&link, WIFI_LINK_EV_START, 100 * MS, 0);
+    handle(&link, WIFI_LINK_EV_DISCONNECTED, 200 * MS, 201);
+    handle(&link, WIFI_LINK_EV_DISCONNECTED, 300 * MS, 201);
+    assert(link.failures == 1);
+    handle(&link, WIFI_LINK_EV_TIMER, 700 * MS, 0);
+    handle(&link, WIFI_LINK_EV_DISCONNECTED, 900 * MS, 201);
+    assert(link.failures == 2);
+    handle(&link, WIFI_LINK_EV_TIMER, 1800 * MS, 0);
+    assert(handle(&link, WIFI_LINK_EV_GOT_IP, 2100 * MS, 0) == WIFI_LINK_ACTION_NONE);
+    assert(wifi_link_is_up(&link) && link.failures == 0);
+    assert(link.connects == 1 && link.last_reconnect_ms == 2000);
+
+    // Losing an established link retries at once, and its first failure
+    // starts the backoff from the bottom again
+    assert(handle(&link, WIFI_LINK_EV_DISCONNECTED, 5000 * MS, 8) == WIFI_LINK_ACTION_CONNECT);
+    assert(!wifi_link_is_up(&link) && link.disconnects == 1 && link.last_reason == 8);
+    assert(handle(&link, WIFI_LINK_EV_DISCONNECTED, 5100 * MS, 201) == WIFI_LINK_ACTION_WAIT);
+    assert(link.failures == 1 && link.retry_in_ms <= 500);
+    handle(&link, WIFI_LINK_EV_TIMER, 5500 * MS, 0);
+    handle(&link, WIFI_LINK_EV_GOT_IP, 5600 * MS, 0);
+    assert(link.connects == 2 && link.last_reconnect_ms == 600);
+    assert(link.max_reconnect_ms == 2000);
+
+    // A repeated GOT_IP (address renewed) is not a reconnect
+    handle(&link, WIFI_LINK_EV_GOT_IP, 9000 * MS, 0);
+    assert(link.connects == 2 && link.last_reconnect_ms == 600);
+}
+
+static void test_rssi(void) {
+    wifi_link_t link;
+    int i;
+
+    wifi_link_init(&link, &config, 1);
+    assert(link.rssi == 0 && !link.weak);
+
+    // The first sample is taken as is, later ones weigh a quarter
+    handle(&link, WIFI_LINK_EV_RSSI, 0, -60);
+    assert(link.rssi == -60 && !link.weak);
+    handle(&link, WIFI_LINK_EV_RSSI, 0, -80);
+    assert(link.rssi == -65);
+
+    // A single bad sample does not make the link weak...
+    handle(&link, WIFI_LINK_EV_RSSI, 0, -95);
+    assert(link.rssi == -72 && !link.weak);
+    handle(&link, WIFI_LINK_EV_RSSI, 0, -60);
+    assert(link.rssi == -69 && !link.weak);
+
+    // ...a run of them does
+    for (i = 0; i < 3; i++) {
+        handle(&link, WIFI_LINK_EV_RSSI, 0, -90);
+    }
+    assert(link.weak);
+    for (i = 0; i < 50; i++) {
+        handle(&link, WIFI_LINK_EV_RSSI, 0, -90);
+    }
+    assert(link.rssi <= -87 && link.rssi >= -90);
+
+    for (i = 0; i < 10; i++) {
+        handle(&link, WIFI_LINK_EV_RSSI, 0, -50);
+    }
+    assert(!link.weak);
+}
+
+int main(void) {
+    test_backoff_growth();
+    test_jitter();
+    test_reconnect();
+    test_rssi();
+    printf("test_wifi_link: ok\n");
+    return 0;
+}
@@ -1,14 +1,109 @@
 #ifndef __TANGIBLE_NETWORK_H__
 #define __TANGIBLE_NETWORK_H__
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "esp_err.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Longest message, including the terminating zero; longer ones are cut
+#define NETWORK_MESSAGE_SIZE 160
+
+// Start the network task and bring WiFi up in the background; returns
+// without waiting for the connection
 void network_init(void);
-esp_err_t post_message(char *msg);
+
+// Whether the station is connected and has an address
+bool network_link_up(void);
+
+// Queue msg for the server and return without waiting for the network.
+// Messages are delivered in order, kept in flash while they cannot be
+// sent. Fails only if the queue is full.
+esp_err_t post_message(const char *msg);
+
+// Points in the life of a card read, in order
+typedef enum {
+    NETWORK_TRACE_SENSOR,       // card sensor edge
+    NETWORK_TRACE_FLASH,        // flash on
+    NETWORK_TRACE_FRAME,        // frame received
+    NETWORK_TRACE_THRESHOLD,    // frame binarized
+    NETWORK_TRACE_IDENTIFY,     // codes located
+    NETWORK_TRACE_DECODE,       // payload decoded
+    NETWORK_TRACE_ENQUEUE,      // posted, set by post_message_traced
+    NETWORK_TRACE_SEND,         // send started that got through, set by the network
+    NETWORK_TRACE_ACK,          // server confirmed, set by the network
+    NETWORK_TRACE_POINTS,
+} network_trace_point_t;
+
+// When a read passed each point, esp_timer_get_time(); 0 if it did not
+typedef struct {
+    int64_t us[NETWORK_TRACE_POINTS];
+} network_trace_t;
+
+// post_message for a traced read. The network adds the points from
+// NETWORK_TRACE_ENQUEUE on, and once the server has the message, counts
+// the trace in the latency histograms. Events stored across a reboot lose
+// their trace.
+esp_err_t post_message_traced(const char *msg, const network_trace_t *trace);
+
+// The sensor point has no stage before it; its slot holds the end to end
+// latency, from sensor edge to ack
+#define NETWORK_LATENCY_TOTAL NETWORK_TRACE_SENSOR
+
+typedef struct {
+    uint32_t count;             // traces counted, recent ones weigh more
+    uint32_t p50_us;
+    uint32_t p95_us;
+    uint32_t p99_us;
+} network_latency_t;
+
+// Latency of the stage ending at point: from the last earlier point the
+// trace has, to point. NETWORK_LATENCY_TOTAL for end to end.
+void network_get_latency(network_trace_point_t point, network_latency_t *latency);
+
+// Log all stages
+void network_log_latency(void);
+
+// Open the connection to the server now, in the background, so that the
+// next post_message does not wait for connecting and the TLS handshake.
+// Call when a card arrives, before reading it.
+void network_prewarm(void);
+
+// Commands from the server, one line each, e.g. "set roi off" or
+// "reread". Called on the network's own task: carry out quickly, or hand
+// over to another task. The result goes back to the server. Only the
+// WebSocket transport (NETWORK_TRANSPORT_WEBSOCKET) receives commands.
+typedef esp_err_t (*network_command_handler_t)(const char *command);
+
+void network_set_command_handler(network_command_handler_t handler);
+
+// Send a greyscale frame to the server, e.g. in answer to a command.
+// ESP_ERR_NOT_SUPPORTED but over the WebSocket transport.
+esp_err_t network_send_frame(const uint8_t *buf, int width, int height);
+
+typedef struct {
+    uint32_t batches;           // requests (datagrams) that got through
+    uint32_t events;            // messages in them
+    uint32_t failures;          // sends that failed and were stored
+    uint32_t connects;          // server connections opened
+    uint32_t last_connect_us;   // time to connect, TLS handshake included
+    uint64_t connect_us_sum;    // over all connects
+
+    // WiFi
+    bool link_up;
+    int rssi;                   // smoothed, dBm
+    uint32_t link_connects;     // addresses obtained, first one included
+    uint32_t link_losses;       // established links lost
+    int last_disconnect_reason; // wifi_err_reason_t
+    uint32_t last_reconnect_ms; // from losing the link (or boot) to an address
+    uint32_t max_reconnect_ms;
+} network_stats_t;
+
+void network_get_stats(network_stats_t *stats);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,67 @@
+#include <string.h>
+
+#include "latency.h"
+
+static int bucket_of(uint32_t us) {
+    int bits = 0;
+
+    if (us < LATENCY_SUB_BUCKETS) {
+        return us;
+    }
+    if (us >= 1u << LATENCY_MAX_BITS) {
+        return LATENCY_BUCKETS - 1;
+    }
+    while (us >> (bits + 1)) {
+        bits++;
+    }
+    // bits >= LATENCY_SUB_BITS: the top bit selects the row, the next
+    // LATENCY_SUB_BITS the bucket within it
+    int shift = bits - LATENCY_SUB_BITS;
+    return (shift + 1) * LATENCY_SUB_BUCKETS + (int)((us >> shift) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+// Middle of the bucket's range
+static uint32_t bucket_value(int bucket) {
+    if (bucket < LATENCY_SUB_BUCKETS) {
+        return bucket;
+    }
+    int shift = bucket / LATENCY_SUB_BUCKETS - 1;
+    uint32_t low = (uint32_t)(LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS) << shift;
+    return low + (1u << shift) / 2;
+}
+
+void latency_add(latency_hist_t *hist, uint32_t us) {
+    int bucket = bucket_of(us);
+    int i;
+
+    if (hist->counts[bucket] == UINT16_MAX) {
+        hist->total = 0;
+        for (i = 0; i < LATENCY_BUCKETS; i++) {
+            hist->counts[i] /= 2;
+            hist->total += hist->counts[i];
+        }
+    }
+    hist->counts[bucket]++;
+    hist->total++;
+}
+
+uint32_t latency_percentile(const latency_hist_t *hist, int percent) {
+    // Rank of the sample, rounded up, at least the first
+    uint32_t rank = ((uint64_t)hist->total * percent + 99) / 100;
+    uint32_t seen = 0;
+    int i;
+
+    if (hist->total == 0) {
+        return 0;
+    }
+    if (rank == 0) {
+        rank = 1;
+    }
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= rank) {
+            return bucket_value(i);
+        }
+    }
+    return bucket_value(LATENCY_BUCKETS - 1);
+}
@@ -0,0 +1,32 @@
+#ifndef __TANGIBLE_LATENCY_H__
+#define __TANGIBLE_LATENCY_H__
+
+#include <stdint.h>
+
+// Latency histogram with logarithmic buckets.
+//
+// Plain C without ESP-IDF calls, like wifi_link.h. Each power of two is
+// split into LATENCY_SUB_BUCKETS buckets, so a percentile read back is
+// within about 6% of the true value at any scale, and the histogram stays
+// the same size however long the device runs. When a bucket would
+// overflow, all counts are halved: older samples then weigh less, and the
+// shape is kept.
+
+#define LATENCY_SUB_BITS 3
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+// Longest latency told apart, 2^27 us (about 2 minutes); longer ones
+// count in the last bucket
+#define LATENCY_MAX_BITS 27
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+typedef struct {
+    uint32_t total;                     // samples, after halving
+    uint16_t counts[LATENCY_BUCKETS];
+} latency_hist_t;
+
+void latency_add(latency_hist_t *hist, uint32_t us);
+
+// Value below which percent of the samples lie; 0 if there are none
+uint32_t latency_percentile(const latency_hist_t *hist, int percent);
+
+#endif
@@ -2,17 +2,20 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
-#include "esp_http_client.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 
 #include "lwip/err.h"
 #include "lwip/sys.h"
 
 #include "network.h"
+#include "outbox.h"
+#include "wifi_link.h"
 
 static const char *TAG = "tgbl-network"; //for log
 
@@ -20,18 +23,12 @@ static const char *TAG = "tgbl-network"; //for log
 #define password "11072030"
 const char* hostname = "Tangible_01";
 
-#define EXAMPLE_ESP_MAXIMUM_RETRY 10
-
 /* FreeRTOS event group to signal when we are connected*/
 static EventGroupHandle_t s_wifi_event_group;
 
-/* The event group allows multiple bits for each event, but we only care about two events:
- * - we are connected to the AP with an IP
- * - we failed to connect after the maximum amount of retries */
+/* The event group allows multiple bits for each event, but we only care about one:
+ * - we are connected to the AP with an IP */
 #define WIFI_CONNECTED_BIT BIT0
-#define WIFI_FAIL_BIT      BIT1
-
-static int s_retry_num = 0;
 
 void log_wifi_event(int32_t event) {
     switch (event) {
@@ -116,99 +113,260 @@ void log_wifi_event(int32_t event) {
     };
 }
 
+/*
+ * Link cache
+ *
+ * The BSSID and channel of the access point, and the IP configuration,
+ * are kept in NVS after each connect. The next boot connects straight to
+ * that access point on that channel instead of scanning all channels,
+ * and with NETWORK_REUSE_IP also takes the address without DHCP. If that
+ * attempt fails, the cache is dropped and the connection is made from
+ * scratch.
+ */
+
+#define WIFI_NVS_NAMESPACE "tgbl_wifi"
+#define WIFI_TASK_STACK_SIZE 4096
+
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;
+    esp_netif_ip_info_t ip_info;
+    esp_netif_dns_info_t dns;
+} link_cache_t;
+
+static esp_netif_t *sta_netif;
+static link_cache_t cache;
+// cache holds a link that worked, read from NVS or saved since
+static bool cache_valid;
+// Connecting with the cached link; not yet known to work
+static bool using_cache;
+
+static void cache_load(void) {
+    nvs_handle_t nvs;
+    size_t len = sizeof(cache);
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    cache_valid = nvs_get_blob(nvs, "link", &cache, &len) == ESP_OK && len == sizeof(cache);
+    nvs_close(nvs);
+}
+
+static void cache_store(const link_cache_t *link) {
+    nvs_handle_t nvs;
+    if (cache_valid && memcmp(link, &cache, sizeof(cache)) == 0) {
+        return;
+    }
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    if (nvs_set_blob(nvs, "link", link, sizeof(*link)) == ESP_OK && nvs_commit(nvs) == ESP_OK) {
+        cache = *link;
+        cache_valid = true;
+        ESP_LOGI(TAG, "Link cached: channel %d", link->channel);
+    }
+    nvs_close(nvs);
+}
+
+static void cache_erase(void) {
+    nvs_handle_t nvs;
+    cache_valid = false;
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+        nvs_erase_key(nvs, "link");
+        nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+}
+
+static void cache_save_current(const esp_netif_ip_info_t *ip_info) {
+    wifi_ap_record_t ap;
+    link_cache_t link;
+
+    if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+        return;
+    }
+    memset(&link, 0, sizeof(link));
+    memcpy(link.bssid, ap.bssid, sizeof(link.bssid));
+    link.channel = ap.primary;
+    link.ip_info = *ip_info;
+    esp_netif_get_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &link.dns);
+    cache_store(&link);
+}
+
+static void set_sta_config(bool from_cache) {
+    wifi_config_t wifi_config = {
+        .sta = {
+            ssid, 
+            password,
+            /* Setting a password implies station will connect to all security modes including WEP/WPA.
+             * However these modes are deprecated and not advisable to be used. Incase your Access point
+             * doesn't support WPA2, these mode can be enabled by commenting below line */
+	        .threshold.authmode = WIFI_AUTH_WPA2_PSK,
+            .pmf_cfg = {
+                .capable = true,
+                .required = false
+            },
+        },
+    };
+    if (from_cache) {
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, cache.bssid, sizeof(cache.bssid));
+        wifi_config.sta.channel = cache.channel;
+    } else {
+        // Of several access points, take the strongest
+        wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+        wifi_config.sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
+    }
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config) );
+
+#if CONFIG_NETWORK_REUSE_IP
+    if (from_cache) {
+        esp_netif_dhcpc_stop(sta_netif);
+        esp_netif_set_ip_info(sta_netif, &cache.ip_info);
+        esp_netif_set_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &cache.dns);
+    } else {
+        esp_netif_dhcpc_start(sta_netif);
+    }
+#endif
+}
+
+/*
+ * Connection manager
+ *
+ * wifi_link.c decides when to connect; this part feeds it the WiFi
+ * events, a backoff timer and RSSI samples, and carries out what it
+ * decides. The link also stops using the cached access point when a
+ * connect to it fails, or when it is lost while the signal was weak, so
+ * that a scan can find a better one.
+ */
+
+static wifi_link_t wifi_conn;
+static SemaphoreHandle_t link_lock;
+static esp_timer_handle_t backoff_timer;
+static esp_timer_handle_t rssi_timer;
+
+static wifi_link_action_t link_handle(wifi_link_event_type_t type, int reason, int rssi) {
+    wifi_link_event_t event = {
+        .type = type,
+        .now_us = esp_timer_get_time(),
+        .reason = reason,
+        .rssi = rssi,
+    };
+    xSemaphoreTake(link_lock, portMAX_DELAY);
+    wifi_link_action_t action = wifi_link_handle(&wifi_conn, &event);
+    uint32_t retry_in_ms = wifi_conn.retry_in_ms;
+    xSemaphoreGive(link_lock);
+
+    if (action == WIFI_LINK_ACTION_CONNECT) {
+        esp_wifi_connect();
+    } else if (action == WIFI_LINK_ACTION_WAIT) {
+        ESP_LOGI(TAG, "Connecting again in %u ms", (unsigned)retry_in_ms);
+        esp_timer_stop(backoff_timer);
+        esp_timer_start_once(backoff_timer, retry_in_ms * 1000ULL);
+    }
+    return action;
+}
+
+static void backoff_expired(void *arg) {
+    link_handle(WIFI_LINK_EV_TIMER, 0, 0);
+}
+
+static void sample_rssi(void *arg) {
+    wifi_ap_record_t ap;
+    if (network_link_up() && esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+        link_handle(WIFI_LINK_EV_RSSI, 0, ap.rssi);
+    }
+}
+
 static void event_handler(void* arg, esp_event_base_t event_base,
                                 int32_t event_id, void* event_data)
 {
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        esp_wifi_connect();
+        link_handle(WIFI_LINK_EV_START, 0, 0);
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        if (s_retry_num < EXAMPLE_ESP_MAXIMUM_RETRY) {
-            esp_wifi_connect();
-            s_retry_num++;
-            ESP_LOGI(TAG, "retry to connect to the AP");
-        } else {
-            xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+        wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *) event_data;
+        xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+        bool attempt_failed = wifi_conn.state == WIFI_LINK_CONNECTING;
+        ESP_LOGI(TAG, "Disconnected, reason %d, rssi %d", event->reason, wifi_conn.rssi);
+        if (using_cache && (attempt_failed || wifi_conn.weak)) {
+            // The access point moved, or the cache is stale, or there may
+            // be a better one: scan
+            ESP_LOGI(TAG, "Leaving the cached access point, scanning");
+            using_cache = false;
+            if (attempt_failed) {
+                cache_erase();
+            }
+            set_sta_config(false);
         }
-        ESP_LOGI(TAG,"connect to the AP fail");
+        link_handle(WIFI_LINK_EV_DISCONNECTED, event->reason, 0);
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-        ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
-        s_retry_num = 0;
+        link_handle(WIFI_LINK_EV_GOT_IP, 0, 0);
+        ESP_LOGI(TAG, "got ip:" IPSTR " after %u ms%s", IP2STR(&event->ip_info.ip),
+                 (unsigned)wifi_conn.last_reconnect_ms, using_cache ? " (cached link)" : "");
+        cache_save_current(&event->ip_info);
+        sample_rssi(NULL);
         xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+        outbox_link_up();
     }
 }
 
-void wifi_init_sta(void)
+// Start the station; connecting carries on in the event handler
+static void wifi_init_sta(void)
 {
     ESP_LOGI(TAG, "Initializing wifi");
-    s_wifi_event_group = xEventGroupCreate();
 
     ESP_ERROR_CHECK(esp_netif_init());
 
     ESP_ERROR_CHECK(esp_event_loop_create_default());
-    esp_netif_t *netif = esp_netif_create_default_wifi_sta();
-    esp_netif_set_hostname(netif, hostname);
+    sta_netif = esp_netif_create_default_wifi_sta();
+    esp_netif_set_hostname(sta_netif, hostname);
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
 
-    esp_event_handler_instance_t instance_any_id;
-    esp_event_handler_instance_t instance_got_ip;
+    const esp_timer_create_args_t backoff_args = {
+        .callback = backoff_expired,
+        .name = "wifi_backoff",
+    };
+    const esp_timer_create_args_t rssi_args = {
+        .callback = sample_rssi,
+        .name = "wifi_rssi",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&backoff_args, &backoff_timer));
+    ESP_ERROR_CHECK(esp_timer_create(&rssi_args, &rssi_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(rssi_timer,
+                                             CONFIG_NETWORK_RSSI_INTERVAL_MS * 1000ULL));
+
+    // Registered for good, so that the station reconnects after losing
+    // the access point
     ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
                                                         ESP_EVENT_ANY_ID,
                                                         &event_handler,
                                                         NULL,
-                                                        &instance_any_id));
+                                                        NULL));
     ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
                                                         IP_EVENT_STA_GOT_IP,
                                                         &event_handler,
                                                         NULL,
-                                                        &instance_got_ip));
+                                                        NULL));
 
-    wifi_config_t wifi_config = {
-        .sta = {
-            ssid, 
-            password,
-            /* Setting a password implies station will connect to all security modes including WEP/WPA.
-             * However these modes are deprecated and not advisable to be used. Incase your Access point
-             * doesn't support WPA2, these mode can be enabled by commenting below line */
-	        .threshold.authmode = WIFI_AUTH_WPA2_PSK,
-            .pmf_cfg = {
-                .capable = true,
-                .required = false
-            },
-        },
-    };
+    cache_load();
+    using_cache = cache_valid;
+    if (using_cache) {
+        ESP_LOGI(TAG, "Connecting with the cached link, channel %d", cache.channel);
+    }
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config) );
+    set_sta_config(using_cache);
     ESP_ERROR_CHECK(esp_wifi_start() );
 
     ESP_LOGI(TAG, "wifi_init_sta finished.");
-
-    /* Waiting until either the connection is established (WIFI_CONNECTED_BIT) or connection failed for the maximum
-     * number of re-tries (WIFI_FAIL_BIT). The bits are set by event_handler() (see above) */
-    EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
-            WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
-            pdFALSE,
-            pdFALSE,
-            portMAX_DELAY);
-
-    /* xEventGroupWaitBits() returns the bits before the call returned, hence we can test which event actually
-     * happened. */
-    if (bits & WIFI_CONNECTED_BIT) {
-        ESP_LOGI(TAG, "connected to ap SSID:%s password:%s", ssid, password);    
-    } else if (bits & WIFI_FAIL_BIT) {
-        ESP_LOGI(TAG, "Failed to connect to SSID:%s, password:%s", ssid, password);
-    } else {
-        ESP_LOGE(TAG, "UNEXPECTED EVENT");
-    }
-
-    /* The event will not be processed after unregister */
-    ESP_ERROR_CHECK(esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, instance_got_ip));
-    ESP_ERROR_CHECK(esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, instance_any_id));
-    vEventGroupDelete(s_wifi_event_group);
 }
 
+static void wifi_task(void *arg)
+{
+    wifi_init_sta();
+    vTaskDelete(NULL);
+}
 
 void network_init(void)
 {
@@ -219,58 +377,89 @@ void network_init(void)
       ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
-    wifi_init_sta();
+    s_wifi_event_group = xEventGroupCreate();
+    link_lock = xSemaphoreCreateMutex();
+    const wifi_link_config_t link_config = {
+        .backoff_min_ms = CONFIG_NETWORK_BACKOFF_MIN_MS,
+        .backoff_max_ms = CONFIG_NETWORK_BACKOFF_MAX_MS,
+        .weak_rssi = CONFIG_NETWORK_WEAK_RSSI,
+    };
+    wifi_link_init(&wifi_conn, &link_config, esp_random());
+    // Messages posted from now on are kept until WiFi is up
+    outbox_init();
+    // WiFi comes up in the background, while the camera and card sensor
+    // are set up
+    xTaskCreate(wifi_task, "wifi_init", WIFI_TASK_STACK_SIZE, NULL,
+                CONFIG_NETWORK_TASK_PRIORITY, NULL);
 }
 
+bool network_link_up(void) {
+    return s_wifi_event_group &&
+           (xEventGroupGetBits(s_wifi_event_group) & WIFI_CONNECTED_BIT);
+}
 
-esp_err_t log_http_event(esp_http_client_event_t *evt)
-{
-    switch(evt->event_id) {
-        case HTTP_EVENT_ERROR:
-            ESP_LOGD(TAG, "HTTP_EVENT_ERROR");
-            break;
-        case HTTP_EVENT_ON_CONNECTED:
-            ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
-            break;
-        case HTTP_EVENT_HEADER_SENT:
-            ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
-            break;
-        case HTTP_EVENT_ON_HEADER:
-            ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER");
-            printf("%.*s", evt->data_len, (char*)evt->data);
-            break;
-        case HTTP_EVENT_ON_DATA:
-            ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-            if (!esp_http_client_is_chunked_response(evt->client)) {
-                printf("%.*s", evt->data_len, (char*)evt->data);
-            }
-            break;
-        case HTTP_EVENT_ON_FINISH:
-            ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
-            break;
-        case HTTP_EVENT_DISCONNECTED:
-            ESP_LOGD(TAG, "HTTP_EVENT_DISCONNECTED");
-            break;
-    }
-    return ESP_OK;
+void network_get_stats(network_stats_t *stats) {
+    outbox_get_stats(stats);
+    xSemaphoreTake(link_lock, portMAX_DELAY);
+    stats->link_up = wifi_link_is_up(&wifi_conn);
+    stats->rssi = wifi_conn.rssi;
+    stats->link_connects = wifi_conn.connects;
+    stats->link_losses = wifi_conn.disconnects;
+    stats->last_disconnect_reason = wifi_conn.last_reason;
+    stats->last_reconnect_ms = wifi_conn.last_reconnect_ms;
+    stats->max_reconnect_ms = wifi_conn.max_reconnect_ms;
+    xSemaphoreGive(link_lock);
+}
+
+
+esp_err_t post_message(const char *msg) {
+    return outbox_post(msg, NULL);
 }
 
-esp_err_t post_message(char *msg) {
-    ESP_LOGI(TAG, "Posting message: %s\n", msg);
+esp_err_t post_message_traced(const char *msg, const network_trace_t *trace) {
+    return outbox_post(msg, trace);
+}
+
+void network_get_latency(network_trace_point_t point, network_latency_t *latency) {
+    outbox_get_latency(point, latency);
+}
 
-    esp_http_client_config_t config = {
-    .url = "http://192.168.1.8/tgbl",
-    .event_handler = log_http_event,
+void network_log_latency(void) {
+    static const char *const stage_names[NETWORK_TRACE_POINTS] = {
+        [NETWORK_LATENCY_TOTAL] = "sensor to ack",
+        [NETWORK_TRACE_FLASH] = "to flash on",
+        [NETWORK_TRACE_FRAME] = "to frame",
+        [NETWORK_TRACE_THRESHOLD] = "to binarized",
+        [NETWORK_TRACE_IDENTIFY] = "to identified",
+        [NETWORK_TRACE_DECODE] = "to decoded",
+        [NETWORK_TRACE_ENQUEUE] = "to enqueued",
+        [NETWORK_TRACE_SEND] = "to send",
+        [NETWORK_TRACE_ACK] = "to ack",
     };
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    esp_err_t err = esp_http_client_perform(client);
+    network_latency_t latency;
+    int i;
 
-    if (err == ESP_OK) {
-        ESP_LOGI(TAG, "Status = %d, content_length = %d",
-                esp_http_client_get_status_code(client),
-                esp_http_client_get_content_length(client));
+    ESP_LOGI(TAG, "Latency [us]: stage, count, p50, p95, p99");
+    for (i = 0; i < NETWORK_TRACE_POINTS; i++) {
+        network_get_latency(i, &latency);
+        if (latency.count) {
+            ESP_LOGI(TAG, "  %-14s %6u %8u %8u %8u", stage_names[i], (unsigned)latency.count,
+                     (unsigned)latency.p50_us, (unsigned)latency.p95_us,
+                     (unsigned)latency.p99_us);
+        }
     }
-    esp_http_client_cleanup(client);
+}
+
+void network_prewarm(void) {
+    outbox_prewarm();
+}
 
-    return err;
-}
\ No newline at end of file
+#if !CONFIG_NETWORK_TRANSPORT_WEBSOCKET
+// No downlink: see transport_ws.c
+void network_set_command_handler(network_command_handler_t handler) {
+}
+
+esp_err_t network_send_frame(const uint8_t *buf, int width, int height) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+#endif
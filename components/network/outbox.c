@@ -0,0 +1,439 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#include "latency.h"
+#include "outbox.h"
+
+static const char *TAG = "tgbl-outbox"; //for log
+
+#define OUTBOX_NVS_NAMESPACE "tgbl_outbox"
+#define OUTBOX_TASK_STACK_SIZE 6144
+// Sequence numbers are reserved in NVS this many at a time, so that only
+// one in this many messages costs a flash write for its number
+#define SEQ_RESERVE 64
+// Sequence numbers of queue items that carry a request to the network
+// task rather than a message
+#define SEQ_PREWARM UINT32_MAX
+#define SEQ_LINK_UP (UINT32_MAX - 1)
+#define SEQ_MARKER SEQ_LINK_UP
+
+static QueueHandle_t queue;
+static nvs_handle_t nvs;
+
+static uint32_t next_seq;
+static uint32_t seq_reserved;
+
+// Ring of unsent events in NVS, slot = counter % CONFIG_NETWORK_RING_SIZE
+static uint32_t ring_head;
+static uint32_t ring_tail;
+// Traces of the events in the ring, by the same slot. In RAM only: the
+// clock they are taken with starts again at every boot.
+static network_trace_t ring_traces[CONFIG_NETWORK_RING_SIZE];
+
+static uint32_t take_seq(void) {
+    if (next_seq >= seq_reserved) {
+        seq_reserved = next_seq + SEQ_RESERVE;
+        if (nvs_set_u32(nvs, "seq", seq_reserved) != ESP_OK || nvs_commit(nvs) != ESP_OK) {
+            ESP_LOGW(TAG, "Could not reserve sequence numbers");
+        }
+    }
+    return next_seq++;
+}
+
+static void ring_key(uint32_t counter, char *key, size_t size) {
+    snprintf(key, size, "ev%u", (unsigned)(counter % CONFIG_NETWORK_RING_SIZE));
+}
+
+static bool ring_empty(void) {
+    return ring_head == ring_tail;
+}
+
+static void ring_save_counters(void) {
+    nvs_set_u32(nvs, "head", ring_head);
+    nvs_set_u32(nvs, "tail", ring_tail);
+    if (nvs_commit(nvs) != ESP_OK) {
+        ESP_LOGW(TAG, "Could not save ring counters");
+    }
+}
+
+static void ring_push(const outbox_event_t *event) {
+    char key[16];
+    ring_key(ring_head, key, sizeof(key));
+    // Only as much of the message as is used
+    size_t len = offsetof(outbox_event_t, msg) + strlen(event->msg) + 1;
+    if (nvs_set_blob(nvs, key, event, len) != ESP_OK) {
+        ESP_LOGE(TAG, "Could not store event %u, dropped", (unsigned)event->seq);
+        return;
+    }
+    if (ring_head - ring_tail == CONFIG_NETWORK_RING_SIZE) {
+        ring_tail++;
+        ESP_LOGW(TAG, "Ring full, oldest event dropped");
+    }
+    ring_traces[ring_head % CONFIG_NETWORK_RING_SIZE] = event->trace;
+    ring_head++;
+    ring_save_counters();
+    ESP_LOGI(TAG, "Event %u stored, %u pending", (unsigned)event->seq,
+             (unsigned)(ring_head - ring_tail));
+}
+
+// Event stored at ring counter; false if it could not be read back
+static bool ring_get(uint32_t counter, outbox_event_t *event) {
+    char key[16];
+    size_t len = sizeof(*event);
+    ring_key(counter, key, sizeof(key));
+    if (nvs_get_blob(nvs, key, event, &len) != ESP_OK) {
+        ESP_LOGE(TAG, "Stored event lost");
+        return false;
+    }
+    return true;
+}
+
+static void ring_pop(uint32_t count) {
+    ring_tail += count;
+    ring_save_counters();
+}
+
+/*
+ * Batches
+ *
+ * Events are handed to the transport in batches of up to
+ * CONFIG_NETWORK_BATCH_MAX, each with its age: the time from post_message
+ * to the send, or -1 if the event was stored before the last reboot, when
+ * it cannot be known.
+ *
+ * After the first event of a batch, the task keeps collecting for a window
+ * of half the smoothed round-trip time (at most
+ * CONFIG_NETWORK_BATCH_WINDOW_MAX_MS). Waiting longer than a round trip
+ * would cost more latency than a second request, and on a fast link the
+ * window shrinks to almost nothing.
+ */
+
+static outbox_event_t batch[CONFIG_NETWORK_BATCH_MAX];
+static int32_t batch_ages[CONFIG_NETWORK_BATCH_MAX];
+static int batch_count;
+// Ring counters below this were stored before this boot
+static uint32_t ring_boot_head;
+static uint32_t rtt_ms = 2 * CONFIG_NETWORK_BATCH_WINDOW_MAX_MS;
+
+// WiFi came up since the task last looked: send stored events now
+static bool link_came_up;
+
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static network_stats_t stats;
+// By stage, indexed by the point that ends it; see network_get_latency
+static latency_hist_t latency[NETWORK_TRACE_POINTS];
+
+static uint32_t now_ms(void) {
+    return esp_timer_get_time() / 1000;
+}
+
+// Count a delivered event's trace in the histograms; stats_lock held
+static void record_trace(const network_trace_t *trace) {
+    int64_t last = 0;
+    int i;
+
+    for (i = 0; i < NETWORK_TRACE_POINTS; i++) {
+        int64_t us = trace->us[i];
+        if (!us) {
+            continue;
+        }
+        if (last && us >= last) {
+            latency_add(&latency[i], us - last);
+        }
+        last = us;
+    }
+    if (trace->us[NETWORK_TRACE_SENSOR] && last > trace->us[NETWORK_TRACE_SENSOR]) {
+        latency_add(&latency[NETWORK_LATENCY_TOTAL], last - trace->us[NETWORK_TRACE_SENSOR]);
+    }
+}
+
+static esp_err_t send_batch(void) {
+    int64_t start = esp_timer_get_time();
+    int i;
+
+    for (i = 0; i < batch_count; i++) {
+        batch[i].trace.us[NETWORK_TRACE_SEND] = start;
+    }
+    esp_err_t err = transport_send(batch, batch_ages, batch_count);
+    int64_t end = esp_timer_get_time();
+    if (err == ESP_OK) {
+        uint32_t sample = (end - start) / 1000;
+        rtt_ms = (7 * rtt_ms + sample) / 8;
+        ESP_LOGI(TAG, "%d events in %u ms, rtt %u ms", batch_count,
+                 (unsigned)sample, (unsigned)rtt_ms);
+    }
+    portENTER_CRITICAL(&stats_lock);
+    if (err == ESP_OK) {
+        stats.batches++;
+        stats.events += batch_count;
+        for (i = 0; i < batch_count; i++) {
+            batch[i].trace.us[NETWORK_TRACE_ACK] = end;
+            record_trace(&batch[i].trace);
+        }
+    } else if (err != ESP_ERR_INVALID_RESPONSE) {
+        stats.failures++;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+    return err;
+}
+
+static bool sent(esp_err_t err) {
+    // Refused for good counts as done: sending again will not help
+    return err == ESP_OK || err == ESP_ERR_INVALID_RESPONSE;
+}
+
+// Collect more events from the queue for the batching window
+static void batch_collect(void) {
+    uint32_t window = rtt_ms / 2;
+    if (window > CONFIG_NETWORK_BATCH_WINDOW_MAX_MS) {
+        window = CONFIG_NETWORK_BATCH_WINDOW_MAX_MS;
+    }
+    int64_t deadline = esp_timer_get_time() + window * 1000LL;
+
+    while (batch_count < CONFIG_NETWORK_BATCH_MAX) {
+        int64_t left = deadline - esp_timer_get_time();
+        TickType_t wait = left > 0 ? pdMS_TO_TICKS(left / 1000) : 0;
+        outbox_event_t *event = &batch[batch_count];
+        if (xQueueReceive(queue, event, wait) != pdTRUE) {
+            break;
+        }
+        if (event->seq >= SEQ_MARKER) {
+            // About to send anyway
+            link_came_up |= event->seq == SEQ_LINK_UP;
+            continue;
+        }
+        event->seq = take_seq();
+        batch_count++;
+    }
+}
+
+// Send the collected batch, or store it if it cannot go now
+static esp_err_t batch_send(void) {
+    esp_err_t err = ESP_FAIL;
+    int i;
+
+    if (ring_empty() && network_link_up()) {
+        for (i = 0; i < batch_count; i++) {
+            batch_ages[i] = now_ms() - batch[i].time_ms;
+        }
+        err = send_batch();
+    }
+    if (!sent(err)) {
+        // Behind older events, WiFi not up yet, or failed
+        for (i = 0; i < batch_count; i++) {
+            ring_push(&batch[i]);
+        }
+    }
+    batch_count = 0;
+    return err;
+}
+
+// Send stored events oldest first, a batch at a time, until one fails
+static esp_err_t ring_replay(void) {
+    if (!network_link_up()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    while (!ring_empty()) {
+        uint32_t count = ring_head - ring_tail;
+        uint32_t i;
+        if (count > CONFIG_NETWORK_BATCH_MAX) {
+            count = CONFIG_NETWORK_BATCH_MAX;
+        }
+        batch_count = 0;
+        for (i = 0; i < count; i++) {
+            uint32_t counter = ring_tail + i;
+            if (ring_get(counter, &batch[batch_count])) {
+                bool age_known = (int32_t)(counter - ring_boot_head) >= 0;
+                batch_ages[batch_count] = age_known ?
+                    (int32_t)(now_ms() - batch[batch_count].time_ms) : -1;
+                if (age_known) {
+                    batch[batch_count].trace = ring_traces[counter % CONFIG_NETWORK_RING_SIZE];
+                } else {
+                    memset(&batch[batch_count].trace, 0, sizeof(network_trace_t));
+                }
+                batch_count++;
+            }
+        }
+        if (batch_count) {
+            esp_err_t err = send_batch();
+            batch_count = 0;
+            if (!sent(err)) {
+                return err;
+            }
+        }
+        ring_pop(count);
+    }
+    return ESP_OK;
+}
+
+static void outbox_task(void *arg) {
+    const TickType_t retry_ticks = pdMS_TO_TICKS(CONFIG_NETWORK_RETRY_MS);
+    TickType_t last_failure = xTaskGetTickCount() - retry_ticks;
+
+    while (true) {
+        TickType_t wait = portMAX_DELAY;
+        if (!ring_empty()) {
+            TickType_t since = xTaskGetTickCount() - last_failure;
+            wait = since < retry_ticks ? retry_ticks - since : 0;
+        }
+        if (xQueueReceive(queue, &batch[0], wait) != pdTRUE) {
+            // Retry interval over
+        } else if (batch[0].seq == SEQ_PREWARM) {
+            if (network_link_up()) {
+                transport_prewarm();
+            }
+        } else if (batch[0].seq == SEQ_LINK_UP) {
+            link_came_up = true;
+            transport_prewarm();
+        } else {
+            batch[0].seq = take_seq();
+            batch_count = 1;
+            batch_collect();
+            if (!sent(batch_send())) {
+                last_failure = xTaskGetTickCount();
+            }
+        }
+        if (link_came_up) {
+            link_came_up = false;
+            last_failure = xTaskGetTickCount() - retry_ticks;
+        }
+        if (!ring_empty() && xTaskGetTickCount() - last_failure >= retry_ticks) {
+            if (ring_replay() != ESP_OK) {
+                last_failure = xTaskGetTickCount();
+            }
+        }
+    }
+}
+
+esp_err_t outbox_init(void) {
+    esp_err_t err = nvs_open(OUTBOX_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Could not open NVS: %s", esp_err_to_name(err));
+        return err;
+    }
+    nvs_get_u32(nvs, "seq", &next_seq);
+    seq_reserved = next_seq;
+    nvs_get_u32(nvs, "head", &ring_head);
+    nvs_get_u32(nvs, "tail", &ring_tail);
+    if (ring_head - ring_tail > CONFIG_NETWORK_RING_SIZE) {
+        ESP_LOGE(TAG, "Ring counters corrupt, pending events dropped");
+        ring_tail = ring_head;
+    }
+    ring_boot_head = ring_head;
+    ESP_LOGI(TAG, "Next sequence number %u, %u events pending",
+             (unsigned)next_seq, (unsigned)(ring_head - ring_tail));
+
+    queue = xQueueCreate(CONFIG_NETWORK_QUEUE_LENGTH, sizeof(outbox_event_t));
+    if (!queue) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(outbox_task, "outbox", OUTBOX_TASK_STACK_SIZE, NULL,
+                    CONFIG_NETWORK_TASK_PRIORITY, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t outbox_post(const char *msg, const network_trace_t *trace) {
+    outbox_event_t item;
+
+    if (!queue) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    item.seq = 0;   // numbered by the network task, in queue order
+    item.time_ms = now_ms();
+    if (trace) {
+        item.trace = *trace;
+    } else {
+        memset(&item.trace, 0, sizeof(item.trace));
+    }
+    item.trace.us[NETWORK_TRACE_ENQUEUE] = esp_timer_get_time();
+    strncpy(item.msg, msg, sizeof(item.msg) - 1);
+    item.msg[sizeof(item.msg) - 1] = 0;
+    if (xQueueSend(queue, &item, 0) != pdTRUE) {
+        ESP_LOGE(TAG, "Queue full, message dropped: %s", msg);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+size_t outbox_encode_text(const outbox_event_t *events, const int32_t *ages_ms,
+                          int count, char *out) {
+    char *start = out;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        const char *c;
+        out += sprintf(out, "%u %d ", (unsigned)events[i].seq, (int)ages_ms[i]);
+        for (c = events[i].msg; *c; c++) {
+            if (*c == '\\' || *c == '\n') {
+                *out++ = '\\';
+                *out++ = *c == '\n' ? 'n' : '\\';
+            } else {
+                *out++ = *c;
+            }
+        }
+        *out++ = '\n';
+    }
+    return out - start;
+}
+
+static void post_marker(uint32_t seq) {
+    outbox_event_t item;
+
+    if (!queue) {
+        return;
+    }
+    item.seq = seq;
+    item.time_ms = now_ms();
+    item.msg[0] = 0;
+    xQueueSend(queue, &item, 0);
+}
+
+void outbox_prewarm(void) {
+    // Pointless if messages are already waiting to go
+    if (queue && uxQueueMessagesWaiting(queue) == 0) {
+        post_marker(SEQ_PREWARM);
+    }
+}
+
+void outbox_link_up(void) {
+    post_marker(SEQ_LINK_UP);
+}
+
+void outbox_note_connect(int64_t us) {
+    portENTER_CRITICAL(&stats_lock);
+    stats.connects++;
+    stats.last_connect_us = us;
+    stats.connect_us_sum += us;
+    portEXIT_CRITICAL(&stats_lock);
+    ESP_LOGI(TAG, "Connected in %u ms", (unsigned)(us / 1000));
+}
+
+void outbox_get_stats(network_stats_t *out) {
+    portENTER_CRITICAL(&stats_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void outbox_get_latency(network_trace_point_t point, network_latency_t *out) {
+    latency_hist_t hist;
+
+    portENTER_CRITICAL(&stats_lock);
+    hist = latency[point];
+    portEXIT_CRITICAL(&stats_lock);
+    out->count = hist.total;
+    out->p50_us = latency_percentile(&hist, 50);
+    out->p95_us = latency_percentile(&hist, 95);
+    out->p99_us = latency_percentile(&hist, 99);
+}
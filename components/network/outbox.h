@@ -0,0 +1,80 @@
+#ifndef __TANGIBLE_OUTBOX_H__
+#define __TANGIBLE_OUTBOX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "network.h"
+
+// Outbound message queue, see the "Network" menu.
+//
+// post_message only copies the message into a queue. A network task takes
+// messages off the queue, numbers them and sends them, several to a
+// request when they arrive close together (see outbox.c). Messages that cannot
+// be sent go to a ring in NVS and are sent again, oldest first, until they
+// get through; while the ring holds anything, new messages queue up behind
+// it, so the server sees them in order. Sequence numbers carry on across
+// reboots, so the server can drop the copies that retries produce.
+// Messages posted before WiFi is up, such as at boot, go to the ring and
+// are sent as soon as it is.
+
+typedef struct {
+    uint32_t seq;
+    uint32_t time_ms;   // uptime when posted
+    char msg[NETWORK_MESSAGE_SIZE];
+    network_trace_t trace;  // not stored in NVS, see ring_traces
+} outbox_event_t;
+
+// Device name (network.c), sent with every batch
+extern const char *hostname;
+
+// Longest line of outbox_encode_text
+#define OUTBOX_TEXT_LINE_MAX (2 * NETWORK_MESSAGE_SIZE + 24)
+
+// Open the ring and start the network task
+esp_err_t outbox_init(void);
+
+// Queue a message, with its trace or NULL; does not block
+esp_err_t outbox_post(const char *msg, const network_trace_t *trace);
+
+// Ask the network task to open the connection ahead of the next message;
+// does not block
+void outbox_prewarm(void);
+
+// WiFi is up (network.c): send what is stored now rather than after the
+// retry interval; does not block
+void outbox_link_up(void);
+
+// Time taken to connect, from the transport
+void outbox_note_connect(int64_t us);
+
+// Fill in the send and connect counts of stats
+void outbox_get_stats(network_stats_t *stats);
+
+// Percentiles of the stage ending at point, see network_get_latency
+void outbox_get_latency(network_trace_point_t point, network_latency_t *latency);
+
+// Write events in the text batch format, one line per event,
+//
+//     <seq> <age ms> <message>\n
+//
+// with backslash and newline in the message escaped as \\ and \n. out
+// must hold count * OUTBOX_TEXT_LINE_MAX bytes; returns the length, not
+// zero-terminated.
+size_t outbox_encode_text(const outbox_event_t *events, const int32_t *ages_ms,
+                          int count, char *out);
+
+// Open the connection to the server if it is not open, so that the next
+// transport_send finds it ready. Implemented by the selected transport.
+void transport_prewarm(void);
+
+// Send count events now, from the network task; ages_ms[i] is the age of
+// events[i], -1 if unknown. Implemented by the selected transport
+// (transport_http.c, transport_udp.c). ESP_OK once the server has them,
+// ESP_ERR_INVALID_RESPONSE if it refused them for good (no point sending
+// again), any other error to try again later.
+esp_err_t transport_send(const outbox_event_t *events, const int32_t *ages_ms, int count);
+
+#endif
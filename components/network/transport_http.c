@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#if CONFIG_NETWORK_HTTPS && !NETWORK_TLS_CA_EMBEDDED
+#include "esp_crt_bundle.h"
+#endif
+
+#include "outbox.h"
+
+static const char *TAG = "tgbl-http"; //for log
+
+#if CONFIG_NETWORK_HTTPS
+#define MESSAGE_URL "https://" CONFIG_NETWORK_SERVER_HOST "/tgbl"
+#if NETWORK_TLS_CA_EMBEDDED
+// CONFIG_NETWORK_TLS_CA_FILE, embedded by CMakeLists.txt
+extern const char server_ca_pem_start[] asm("_binary_server_ca_pem_start");
+#endif
+#else
+#define MESSAGE_URL "http://" CONFIG_NETWORK_SERVER_HOST "/tgbl"
+#endif
+
+// Whether the client holds an open connection, and when the current
+// attempt to use it started, to time connecting (and the TLS handshake)
+static bool connected;
+static int64_t connect_start_us;
+// End of the last request that got a response
+static int64_t last_exchange_us;
+
+esp_err_t log_http_event(esp_http_client_event_t *evt)
+{
+    switch(evt->event_id) {
+        case HTTP_EVENT_ERROR:
+            ESP_LOGD(TAG, "HTTP_EVENT_ERROR");
+            break;
+        case HTTP_EVENT_ON_CONNECTED:
+            ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
+            connected = true;
+            outbox_note_connect(esp_timer_get_time() - connect_start_us);
+            break;
+        case HTTP_EVENT_HEADER_SENT:
+            ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
+            break;
+        case HTTP_EVENT_ON_HEADER:
+            ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER");
+            printf("%.*s", evt->data_len, (char*)evt->data);
+            break;
+        case HTTP_EVENT_ON_DATA:
+            ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
+            if (!esp_http_client_is_chunked_response(evt->client)) {
+                printf("%.*s", evt->data_len, (char*)evt->data);
+            }
+            break;
+        case HTTP_EVENT_ON_FINISH:
+            ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
+            break;
+        case HTTP_EVENT_DISCONNECTED:
+            ESP_LOGD(TAG, "HTTP_EVENT_DISCONNECTED");
+            connected = false;
+            break;
+    }
+    return ESP_OK;
+}
+
+/*
+ * Message client
+ *
+ * One client lives for the life of the firmware, so consecutive messages
+ * go over the same keep-alive connection: about one round trip each
+ * instead of a TCP handshake plus client setup and teardown. If the server
+ * has closed the connection in the meantime, the first attempt fails on
+ * the dead socket and the message is sent again on a new one.
+ *
+ * Over HTTPS, each new connection costs a full TLS handshake, so
+ * transport_prewarm opens the connection with a HEAD request when a card
+ * arrives, and the handshake runs while the card is being read.
+ *
+ * A server that drops an idle keep-alive connection does not tell the
+ * client: the socket only turns out dead on the next request. So a
+ * connection idle for longer than CONFIG_NETWORK_HTTP_KEEPALIVE_IDLE_MS
+ * counts as closed, and transport_prewarm replaces it.
+ */
+
+static esp_http_client_handle_t message_client;
+
+static esp_http_client_handle_t get_message_client(void) {
+    if (!message_client) {
+        esp_http_client_config_t config = {
+            .url = MESSAGE_URL,
+            .method = HTTP_METHOD_POST,
+            .event_handler = log_http_event,
+#if CONFIG_NETWORK_HTTPS
+#if NETWORK_TLS_CA_EMBEDDED
+            .cert_pem = server_ca_pem_start,
+#else
+            .crt_bundle_attach = esp_crt_bundle_attach,
+#endif
+#endif
+        };
+        message_client = esp_http_client_init(&config);
+        if (message_client) {
+            esp_http_client_set_header(message_client, "Content-Type", "text/x-tgbl-batch");
+            esp_http_client_set_header(message_client, "X-Tgbl-Device", hostname);
+        }
+    }
+    return message_client;
+}
+
+// Close the connection if the server has likely dropped it by now
+static void close_if_idle(esp_http_client_handle_t client) {
+    int64_t idle_us = esp_timer_get_time() - last_exchange_us;
+    if (connected && idle_us >= CONFIG_NETWORK_HTTP_KEEPALIVE_IDLE_MS * 1000LL) {
+        ESP_LOGI(TAG, "Connection idle for %lld ms, reopening", idle_us / 1000);
+        esp_http_client_close(client);
+        connected = false;
+    }
+}
+
+// Batch body, text/x-tgbl-batch, see outbox_encode_text
+static char body[CONFIG_NETWORK_BATCH_MAX * OUTBOX_TEXT_LINE_MAX];
+
+// Runs on the outbox task only
+esp_err_t transport_send(const outbox_event_t *events, const int32_t *ages_ms, int count) {
+    size_t len = outbox_encode_text(events, ages_ms, count, body);
+    ESP_LOGI(TAG, "Posting %d events, %d bytes", count, (int)len);
+
+    esp_http_client_handle_t client = get_message_client();
+    if (!client) {
+        return ESP_ERR_NO_MEM;
+    }
+    close_if_idle(client);
+    int64_t start = esp_timer_get_time();
+    esp_http_client_set_post_field(client, body, len);
+    connect_start_us = start;
+    esp_err_t err = esp_http_client_perform(client);
+    if (err != ESP_OK) {
+        ESP_LOGI(TAG, "Post failed (%s), reconnecting", esp_err_to_name(err));
+        esp_http_client_close(client);
+        connect_start_us = esp_timer_get_time();
+        err = esp_http_client_perform(client);
+    }
+
+    if (err != ESP_OK) {
+        // Start from a clean connection next time
+        esp_http_client_close(client);
+        return err;
+    }
+    last_exchange_us = esp_timer_get_time();
+    int status = esp_http_client_get_status_code(client);
+    ESP_LOGI(TAG, "Status = %d, content_length = %d, %lld us",
+            status,
+            esp_http_client_get_content_length(client),
+            esp_timer_get_time() - start);
+    if (status >= 200 && status < 300) {
+        return ESP_OK;
+    }
+    // Only a batch the server cannot parse or take is refused for good.
+    // Anything else (redirects, auth, rate limits, server errors) may pass
+    // later, so the batch stays in the ring.
+    if (status == 400 || status == 413 || status == 415) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    return ESP_FAIL;
+}
+
+void transport_prewarm(void) {
+    esp_http_client_handle_t client = get_message_client();
+    if (!client) {
+        return;
+    }
+    close_if_idle(client);
+    if (connected) {
+        return;
+    }
+    esp_http_client_set_method(client, HTTP_METHOD_HEAD);
+    esp_http_client_set_post_field(client, NULL, 0);
+    connect_start_us = esp_timer_get_time();
+    esp_err_t err = esp_http_client_perform(client);
+    esp_http_client_set_method(client, HTTP_METHOD_POST);
+    if (err != ESP_OK) {
+        ESP_LOGI(TAG, "Prewarm failed (%s)", esp_err_to_name(err));
+        esp_http_client_close(client);
+    } else {
+        last_exchange_us = esp_timer_get_time();
+    }
+}
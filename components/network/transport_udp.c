@@ -0,0 +1,192 @@
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/netdb.h"
+#include "lwip/sockets.h"
+
+#include "outbox.h"
+
+static const char *TAG = "tgbl-udp"; //for log
+
+/*
+ * Datagram transport
+ *
+ * A batch goes out as one datagram (more if it does not fit in
+ * UDP_PACKET_MAX) and the server answers each with an ack. Integers are
+ * big-endian.
+ *
+ *     events: 'T' 'G' 1, device length (1), device,
+ *             event count (1), then per event:
+ *             seq (4), age ms (4, signed, -1 if unknown),
+ *             message length (1), message
+ *     ack:    'T' 'G' 2, seq of the first event (4), event count (1)
+ *
+ * Unacknowledged datagrams are sent again after
+ * CONFIG_NETWORK_UDP_ACK_TIMEOUT_MS, doubling the wait each time, up to
+ * CONFIG_NETWORK_UDP_RETRIES times. Acks that do not match the datagram in
+ * flight (late acks of an earlier copy) are ignored; the server drops
+ * events whose sequence number it has already seen from this device, but
+ * still acks them.
+ */
+
+#define UDP_PACKET_MAX 1200
+#define UDP_TYPE_EVENTS 1
+#define UDP_TYPE_ACK 2
+#define UDP_ACK_SIZE 8
+// Per event: seq, age and length bytes
+#define UDP_EVENT_OVERHEAD 9
+
+static int sock = -1;
+static struct sockaddr_in server;
+static uint8_t packet[UDP_PACKET_MAX];
+
+static uint8_t *put_u32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+    return p + 4;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static esp_err_t open_socket(void) {
+    const struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_DGRAM,
+    };
+    struct addrinfo *res;
+    int64_t start = esp_timer_get_time();
+
+    if (sock >= 0) {
+        return ESP_OK;
+    }
+    if (getaddrinfo(CONFIG_NETWORK_SERVER_HOST, NULL, &hints, &res) != 0 || !res) {
+        ESP_LOGE(TAG, "Could not resolve " CONFIG_NETWORK_SERVER_HOST);
+        return ESP_FAIL;
+    }
+    memcpy(&server, res->ai_addr, sizeof(server));
+    server.sin_port = htons(CONFIG_NETWORK_UDP_PORT);
+    freeaddrinfo(res);
+
+    sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Could not create socket: errno %d", errno);
+        return ESP_FAIL;
+    }
+    // Mostly the name lookup
+    outbox_note_connect(esp_timer_get_time() - start);
+    return ESP_OK;
+}
+
+static void close_socket(void) {
+    close(sock);
+    sock = -1;
+}
+
+// Fill packet with as many events as fit, from the first one; returns the
+// packet length and the number of events in *taken
+static size_t encode_packet(const outbox_event_t *events, const int32_t *ages_ms,
+                            int count, int *taken) {
+    size_t name_len = strlen(hostname);
+    uint8_t *p = packet;
+    uint8_t *count_at;
+    int n = 0;
+
+    *p++ = 'T';
+    *p++ = 'G';
+    *p++ = UDP_TYPE_EVENTS;
+    *p++ = name_len;
+    memcpy(p, hostname, name_len);
+    p += name_len;
+    count_at = p++;
+
+    for (n = 0; n < count; n++) {
+        size_t len = strlen(events[n].msg);
+        if (n > 0 && (size_t)(p - packet) + UDP_EVENT_OVERHEAD + len > UDP_PACKET_MAX) {
+            break;
+        }
+        p = put_u32(p, events[n].seq);
+        p = put_u32(p, (uint32_t)ages_ms[n]);
+        *p++ = len;
+        memcpy(p, events[n].msg, len);
+        p += len;
+    }
+    *count_at = n;
+    *taken = n;
+    return p - packet;
+}
+
+// Wait up to timeout_ms for the ack of count events from first_seq
+static bool wait_ack(uint32_t first_seq, int count, int timeout_ms) {
+    uint8_t ack[UDP_ACK_SIZE];
+    int64_t deadline = esp_timer_get_time() + timeout_ms * 1000LL;
+
+    while (true) {
+        int64_t left = deadline - esp_timer_get_time();
+        struct timeval tv;
+        fd_set fds;
+
+        if (left <= 0) {
+            return false;
+        }
+        tv.tv_sec = left / 1000000;
+        tv.tv_usec = left % 1000000;
+        FD_ZERO(&fds);
+        FD_SET(sock, &fds);
+        if (select(sock + 1, &fds, NULL, NULL, &tv) <= 0) {
+            return false;
+        }
+        int len = recv(sock, ack, sizeof(ack), 0);
+        if (len == UDP_ACK_SIZE && ack[0] == 'T' && ack[1] == 'G' &&
+            ack[2] == UDP_TYPE_ACK && get_u32(ack + 3) == first_seq && ack[7] == count) {
+            return true;
+        }
+        ESP_LOGD(TAG, "Stray datagram ignored");
+    }
+}
+
+// Runs on the outbox task only
+esp_err_t transport_send(const outbox_event_t *events, const int32_t *ages_ms, int count) {
+    if (open_socket() != ESP_OK) {
+        return ESP_FAIL;
+    }
+    while (count > 0) {
+        int taken;
+        size_t len = encode_packet(events, ages_ms, count, &taken);
+        int timeout_ms = CONFIG_NETWORK_UDP_ACK_TIMEOUT_MS;
+        int attempt;
+
+        for (attempt = 0; attempt <= CONFIG_NETWORK_UDP_RETRIES; attempt++) {
+            if (sendto(sock, packet, len, 0, (struct sockaddr *)&server, sizeof(server)) < 0) {
+                ESP_LOGI(TAG, "Send failed: errno %d", errno);
+                close_socket();
+                return ESP_FAIL;
+            }
+            if (wait_ack(events[0].seq, taken, timeout_ms)) {
+                break;
+            }
+            timeout_ms *= 2;
+        }
+        if (attempt > CONFIG_NETWORK_UDP_RETRIES) {
+            ESP_LOGI(TAG, "No ack for %d events from %u", taken, (unsigned)events[0].seq);
+            return ESP_ERR_TIMEOUT;
+        }
+        ESP_LOGI(TAG, "%d events, %d bytes, acked after %d resends",
+                 taken, (int)len, attempt);
+        events += taken;
+        ages_ms += taken;
+        count -= taken;
+    }
+    return ESP_OK;
+}
+
+void transport_prewarm(void) {
+    // Nothing to handshake; resolve the server and open the socket
+    open_socket();
+}
@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_websocket_client.h"
+
+#include "outbox.h"
+
+static const char *TAG = "tgbl-ws"; //for log
+
+/*
+ * WebSocket transport
+ *
+ * One connection per device carries both directions, and stays open:
+ * esp_websocket_client reconnects by itself after losing it. Text frames
+ * hold one or more lines.
+ *
+ * Device to server:
+ *
+ *     hello <device>                  first, on every connect
+ *     <seq> <age ms> <message>        events, one frame per batch, in the
+ *                                     format of outbox_encode_text
+ *     ok <command>                    a command was carried out
+ *     err <error> <command>           or not
+ *
+ * Server to device:
+ *
+ *     ack <first seq> <count>         the batch starting at first seq
+ *                                     arrived; until then it counts as
+ *                                     unsent
+ *     anything else                   a command for the handler set with
+ *                                     network_set_command_handler
+ *
+ * Frames from network_send_frame go as binary messages of up to
+ * WS_FRAME_CHUNK pixels each, with a header of
+ *
+ *     'F', frame number (2), width (2), height (2), pixel offset (4)
+ *
+ * big-endian.
+ */
+
+#define WS_URI "ws://" CONFIG_NETWORK_SERVER_HOST "/tgbl/ws"
+#define WS_SEND_TIMEOUT_MS 1000
+#define WS_FRAME_CHUNK 4096
+#define WS_FRAME_HEADER 11
+// Longest command line
+#define WS_COMMAND_MAX 128
+// Client buffers; a message larger than them would be split into
+// several, so they hold a whole batch or frame chunk
+#define WS_BATCH_SIZE (CONFIG_NETWORK_BATCH_MAX * OUTBOX_TEXT_LINE_MAX)
+#define WS_BUFFER_SIZE (WS_BATCH_SIZE > WS_FRAME_HEADER + WS_FRAME_CHUNK ? \
+                        WS_BATCH_SIZE : WS_FRAME_HEADER + WS_FRAME_CHUNK)
+
+typedef struct {
+    uint32_t first_seq;
+    int count;
+} ws_ack_t;
+
+static esp_websocket_client_handle_t client;
+static QueueHandle_t ack_queue;
+static network_command_handler_t command_handler;
+static char body[WS_BATCH_SIZE];
+static int64_t connect_start_us;
+
+static void send_line(const char *line) {
+    esp_websocket_client_send_text(client, line, strlen(line),
+                                   pdMS_TO_TICKS(WS_SEND_TIMEOUT_MS));
+}
+
+// Runs on the websocket client task: acks go to the waiting sender,
+// commands to the handler, and are answered
+static void handle_line(char *line) {
+    char reply[WS_COMMAND_MAX + 32];
+    unsigned first;
+    int count;
+
+    if (sscanf(line, "ack %u %d", &first, &count) == 2) {
+        ws_ack_t ack = {first, count};
+        xQueueOverwrite(ack_queue, &ack);
+        return;
+    }
+    if (!command_handler) {
+        ESP_LOGI(TAG, "No handler for command: %s", line);
+        return;
+    }
+    ESP_LOGI(TAG, "Command: %s", line);
+    esp_err_t err = command_handler(line);
+    if (err == ESP_OK) {
+        snprintf(reply, sizeof(reply), "ok %s", line);
+    } else {
+        snprintf(reply, sizeof(reply), "err %s %s", esp_err_to_name(err), line);
+    }
+    send_line(reply);
+}
+
+static void handle_text(const char *data, int len) {
+    char line[WS_COMMAND_MAX];
+    const char *end = data + len;
+
+    while (data < end) {
+        const char *eol = memchr(data, '\n', end - data);
+        int n = (eol ? eol : end) - data;
+        if (n > 0 && n < (int)sizeof(line)) {
+            memcpy(line, data, n);
+            line[n] = 0;
+            handle_line(line);
+        } else if (n > 0) {
+            ESP_LOGW(TAG, "Line of %d bytes ignored", n);
+        }
+        data += n + 1;
+    }
+}
+
+static void ws_event(void *arg, esp_event_base_t base, int32_t event_id, void *event_data) {
+    esp_websocket_event_data_t *data = (esp_websocket_event_data_t *)event_data;
+    char hello[64];
+
+    switch (event_id) {
+        case WEBSOCKET_EVENT_CONNECTED:
+            outbox_note_connect(esp_timer_get_time() - connect_start_us);
+            snprintf(hello, sizeof(hello), "hello %s", hostname);
+            send_line(hello);
+            break;
+        case WEBSOCKET_EVENT_DISCONNECTED:
+            ESP_LOGI(TAG, "Disconnected");
+            // The client reconnects after its reconnect delay, which the
+            // next connect time includes
+            connect_start_us = esp_timer_get_time();
+            break;
+        case WEBSOCKET_EVENT_DATA:
+            // Text only, and only whole messages: commands are short
+            if (data->op_code == 1 && data->payload_offset == 0 &&
+                data->data_len == data->payload_len) {
+                handle_text(data->data_ptr, data->data_len);
+            }
+            break;
+        case WEBSOCKET_EVENT_ERROR:
+            ESP_LOGI(TAG, "Error");
+            break;
+    }
+}
+
+static esp_err_t start_client(void) {
+    if (client) {
+        return ESP_OK;
+    }
+    const esp_websocket_client_config_t config = {
+        .uri = WS_URI,
+        .port = CONFIG_NETWORK_WS_PORT,
+        .buffer_size = WS_BUFFER_SIZE,
+    };
+    ack_queue = xQueueCreate(1, sizeof(ws_ack_t));
+    client = esp_websocket_client_init(&config);
+    if (!ack_queue || !client) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_websocket_register_events(client, WEBSOCKET_EVENT_ANY, ws_event, NULL);
+    connect_start_us = esp_timer_get_time();
+    return esp_websocket_client_start(client);
+}
+
+// Runs on the outbox task only
+esp_err_t transport_send(const outbox_event_t *events, const int32_t *ages_ms, int count) {
+    ws_ack_t ack;
+
+    if (start_client() != ESP_OK || !esp_websocket_client_is_connected(client)) {
+        return ESP_FAIL;
+    }
+    size_t len = outbox_encode_text(events, ages_ms, count, body);
+    xQueueReset(ack_queue);
+    if (esp_websocket_client_send_text(client, body, len,
+                                       pdMS_TO_TICKS(WS_SEND_TIMEOUT_MS)) < 0) {
+        ESP_LOGI(TAG, "Send failed");
+        return ESP_FAIL;
+    }
+
+    TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(CONFIG_NETWORK_WS_ACK_TIMEOUT_MS);
+    while (true) {
+        TickType_t now = xTaskGetTickCount();
+        TickType_t wait = (int32_t)(deadline - now) > 0 ? deadline - now : 0;
+        if (xQueueReceive(ack_queue, &ack, wait) != pdTRUE) {
+            ESP_LOGI(TAG, "No ack for %d events from %u", count, (unsigned)events[0].seq);
+            return ESP_ERR_TIMEOUT;
+        }
+        // A late ack of an earlier attempt does not count
+        if (ack.first_seq == events[0].seq && ack.count == count) {
+            ESP_LOGI(TAG, "%d events, %d bytes, acked", count, (int)len);
+            return ESP_OK;
+        }
+    }
+}
+
+void transport_prewarm(void) {
+    // Started once, then kept open (and reopened) by the client
+    start_client();
+}
+
+void network_set_command_handler(network_command_handler_t handler) {
+    command_handler = handler;
+}
+
+esp_err_t network_send_frame(const uint8_t *buf, int width, int height) {
+    static uint16_t frame_number;
+    static uint8_t chunk[WS_FRAME_HEADER + WS_FRAME_CHUNK];
+    int total = width * height;
+    int offset;
+
+    if (!client || !esp_websocket_client_is_connected(client)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    frame_number++;
+    for (offset = 0; offset < total; offset += WS_FRAME_CHUNK) {
+        int n = total - offset < WS_FRAME_CHUNK ? total - offset : WS_FRAME_CHUNK;
+        chunk[0] = 'F';
+        chunk[1] = frame_number >> 8;
+        chunk[2] = frame_number;
+        chunk[3] = width >> 8;
+        chunk[4] = width;
+        chunk[5] = height >> 8;
+        chunk[6] = height;
+        chunk[7] = offset >> 24;
+        chunk[8] = offset >> 16;
+        chunk[9] = offset >> 8;
+        chunk[10] = offset;
+        memcpy(chunk + WS_FRAME_HEADER, buf + offset, n);
+        if (esp_websocket_client_send_bin(client, (const char *)chunk, WS_FRAME_HEADER + n,
+                                          pdMS_TO_TICKS(WS_SEND_TIMEOUT_MS)) < 0) {
+            ESP_LOGI(TAG, "Frame %u send failed at %d", frame_number, offset);
+            return ESP_FAIL;
+        }
+    }
+    ESP_LOGI(TAG, "Frame %u sent, %dx%d", frame_number, width, height);
+    return ESP_OK;
+}
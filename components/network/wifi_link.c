@@ -0,0 +1,99 @@
+#include "wifi_link.h"
+
+// Weight of a new RSSI sample in the smoothed value is 1/n
+#define RSSI_SMOOTHING 4
+
+static uint32_t next_random(wifi_link_t *link) {
+    // xorshift32; only spreads retries, nothing depends on its quality
+    uint32_t x = link->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    link->random = x;
+    return x;
+}
+
+// Wait after the n-th consecutive failure: a random point in the upper
+// half of min * 2^(n-1), capped at max
+static uint32_t backoff_ms(wifi_link_t *link) {
+    uint32_t limit = link->config.backoff_min_ms;
+    uint32_t i;
+
+    for (i = 1; i < link->failures && limit < link->config.backoff_max_ms; i++) {
+        limit *= 2;
+    }
+    if (limit > link->config.backoff_max_ms) {
+        limit = link->config.backoff_max_ms;
+    }
+    return limit - limit / 2 + next_random(link) % (limit / 2 + 1);
+}
+
+void wifi_link_init(wifi_link_t *link, const wifi_link_config_t *config, uint32_t seed) {
+    *link = (wifi_link_t){0};
+    link->config = *config;
+    link->state = WIFI_LINK_IDLE;
+    link->random = seed ? seed : 1;
+}
+
+bool wifi_link_is_up(const wifi_link_t *link) {
+    return link->state == WIFI_LINK_UP;
+}
+
+wifi_link_action_t wifi_link_handle(wifi_link_t *link, const wifi_link_event_t *event) {
+    switch (event->type) {
+        case WIFI_LINK_EV_START:
+            link->state = WIFI_LINK_CONNECTING;
+            link->failures = 0;
+            link->down_since_us = event->now_us;
+            return WIFI_LINK_ACTION_CONNECT;
+
+        case WIFI_LINK_EV_GOT_IP:
+            if (link->state != WIFI_LINK_UP) {
+                uint32_t ms = (event->now_us - link->down_since_us) / 1000;
+                link->last_reconnect_ms = ms;
+                if (ms > link->max_reconnect_ms) {
+                    link->max_reconnect_ms = ms;
+                }
+                link->connects++;
+            }
+            link->state = WIFI_LINK_UP;
+            link->failures = 0;
+            return WIFI_LINK_ACTION_NONE;
+
+        case WIFI_LINK_EV_DISCONNECTED:
+            link->last_reason = event->reason;
+            if (link->state == WIFI_LINK_UP) {
+                // Lost an established link: the access point is probably
+                // still there, try straight away
+                link->disconnects++;
+                link->down_since_us = event->now_us;
+                link->state = WIFI_LINK_CONNECTING;
+                return WIFI_LINK_ACTION_CONNECT;
+            }
+            if (link->state == WIFI_LINK_CONNECTING) {
+                link->failures++;
+                link->retry_in_ms = backoff_ms(link);
+                link->state = WIFI_LINK_BACKOFF;
+                return WIFI_LINK_ACTION_WAIT;
+            }
+            // Already waiting, or not started
+            return WIFI_LINK_ACTION_NONE;
+
+        case WIFI_LINK_EV_TIMER:
+            if (link->state != WIFI_LINK_BACKOFF) {
+                return WIFI_LINK_ACTION_NONE;
+            }
+            link->state = WIFI_LINK_CONNECTING;
+            return WIFI_LINK_ACTION_CONNECT;
+
+        case WIFI_LINK_EV_RSSI:
+            if (link->rssi == 0) {
+                link->rssi = event->rssi;
+            } else {
+                link->rssi += (event->rssi - link->rssi) / RSSI_SMOOTHING;
+            }
+            link->weak = link->rssi < link->config.weak_rssi;
+            return WIFI_LINK_ACTION_NONE;
+    }
+    return WIFI_LINK_ACTION_NONE;
+}
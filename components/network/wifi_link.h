@@ -0,0 +1,79 @@
+#ifndef __TANGIBLE_WIFI_LINK_H__
+#define __TANGIBLE_WIFI_LINK_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// WiFi connection manager state machine.
+//
+// Plain C without ESP-IDF calls, so that it can be driven on a PC with
+// made-up event sequences. network.c feeds it the WiFi events, its timer
+// and RSSI samples, and carries out the returned action. Times are in
+// microseconds, from any fixed origin.
+//
+// The station reconnects for as long as the device runs. After a failed
+// attempt it waits a backoff that doubles from backoff_min_ms up to
+// backoff_max_ms, each wait drawn at random from its upper half so that a
+// room full of devices does not hammer the access point in step. Losing
+// an established link is retried at once, without backoff.
+
+typedef enum {
+    WIFI_LINK_IDLE,         // not started
+    WIFI_LINK_CONNECTING,   // attempt in progress
+    WIFI_LINK_BACKOFF,      // waiting to try again
+    WIFI_LINK_UP,           // connected with an address
+} wifi_link_state_t;
+
+typedef enum {
+    WIFI_LINK_EV_START,         // station started
+    WIFI_LINK_EV_GOT_IP,
+    WIFI_LINK_EV_DISCONNECTED,  // reason: wifi_err_reason_t
+    WIFI_LINK_EV_TIMER,         // backoff timer expired
+    WIFI_LINK_EV_RSSI,          // rssi: sample of the access point's signal
+} wifi_link_event_type_t;
+
+typedef struct {
+    wifi_link_event_type_t type;
+    int64_t now_us;
+    int reason;
+    int rssi;
+} wifi_link_event_t;
+
+typedef enum {
+    WIFI_LINK_ACTION_NONE,
+    WIFI_LINK_ACTION_CONNECT,   // call esp_wifi_connect
+    WIFI_LINK_ACTION_WAIT,      // arm the timer for retry_in_ms
+} wifi_link_action_t;
+
+typedef struct {
+    uint32_t backoff_min_ms;
+    uint32_t backoff_max_ms;
+    int weak_rssi;          // dBm; a link below this on average is weak
+} wifi_link_config_t;
+
+typedef struct {
+    wifi_link_config_t config;
+    wifi_link_state_t state;
+    uint32_t failures;      // consecutive failed attempts
+    uint32_t retry_in_ms;   // wait before the next attempt, in BACKOFF
+    uint32_t random;        // xorshift state for the jitter
+
+    int rssi;               // smoothed, dBm; 0 until sampled
+    bool weak;              // smoothed RSSI below config.weak_rssi
+
+    int64_t down_since_us;  // when the link was lost, or started
+    uint32_t connects;
+    uint32_t disconnects;   // of an established link
+    int last_reason;        // of the last disconnect event
+    uint32_t last_reconnect_ms;
+    uint32_t max_reconnect_ms;
+} wifi_link_t;
+
+void wifi_link_init(wifi_link_t *link, const wifi_link_config_t *config, uint32_t seed);
+
+// Feed an event; returns what to do next
+wifi_link_action_t wifi_link_handle(wifi_link_t *link, const wifi_link_event_t *event);
+
+bool wifi_link_is_up(const wifi_link_t *link);
+
+#endif
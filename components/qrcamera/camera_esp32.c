@@ -0,0 +1,255 @@
+#include "freertos/FreeRTOS.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_camera.h"
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+
+#include "camera_source.h"
+
+static const char *TAG = "camera-esp32"; //for log
+
+static camera_config_t camera_config;
+static camera_window_t window;
+// The window before the last set_window, for frames the driver started
+// capturing before window_since_us
+static camera_window_t prev_window;
+static int64_t window_since_us;
+static portMUX_TYPE window_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const gpio_num_t flash_pin = GPIO_NUM_4;
+
+// Timer 0 and channel 0 generate XCLK for the camera
+#define FLASH_LEDC_MODE     LEDC_HIGH_SPEED_MODE
+#define FLASH_LEDC_TIMER    LEDC_TIMER_1
+#define FLASH_LEDC_CHANNEL  LEDC_CHANNEL_1
+#define FLASH_LEDC_BITS     LEDC_TIMER_8_BIT
+#define FLASH_LEDC_FREQ_HZ  20000
+
+#define PWDN_GPIO_NUM     32
+#define RESET_GPIO_NUM    -1
+#define XCLK_GPIO_NUM      0
+#define SIOD_GPIO_NUM     26
+#define SIOC_GPIO_NUM     27
+#define Y9_GPIO_NUM       35
+#define Y8_GPIO_NUM       34
+#define Y7_GPIO_NUM       39
+#define Y6_GPIO_NUM       36
+#define Y5_GPIO_NUM       21
+#define Y4_GPIO_NUM       19
+#define Y3_GPIO_NUM       18
+#define Y2_GPIO_NUM        5
+#define VSYNC_GPIO_NUM    25
+#define HREF_GPIO_NUM     23
+#define PCLK_GPIO_NUM     22
+
+
+// packages/esp32/hardware/esp32/1.0.5/tools/sdk/include/esp32-camera/esp_camera.h
+// https://github.com/espressif/esp32-camera
+// https://github.com/espressif/esp32-camera/blob/master/driver/include/sensor.h
+
+static esp_err_t setup_camera(int fb_count) {
+    camera_config.ledc_channel = LEDC_CHANNEL_0;
+    camera_config.ledc_timer = LEDC_TIMER_0;
+    camera_config.pin_d0 = Y2_GPIO_NUM;
+    camera_config.pin_d1 = Y3_GPIO_NUM;
+    camera_config.pin_d2 = Y4_GPIO_NUM;
+    camera_config.pin_d3 = Y5_GPIO_NUM;
+    camera_config.pin_d4 = Y6_GPIO_NUM;
+    camera_config.pin_d5 = Y7_GPIO_NUM;
+    camera_config.pin_d6 = Y8_GPIO_NUM;
+    camera_config.pin_d7 = Y9_GPIO_NUM;
+    camera_config.pin_xclk = XCLK_GPIO_NUM;
+    camera_config.pin_pclk = PCLK_GPIO_NUM;
+    camera_config.pin_vsync = VSYNC_GPIO_NUM;
+    camera_config.pin_href = HREF_GPIO_NUM;
+    camera_config.pin_sscb_sda = SIOD_GPIO_NUM;
+    camera_config.pin_sscb_scl = SIOC_GPIO_NUM;
+    camera_config.pin_pwdn = PWDN_GPIO_NUM;
+    camera_config.pin_reset = RESET_GPIO_NUM;
+    camera_config.xclk_freq_hz = 10000000;
+    camera_config.pixel_format = PIXFORMAT_GRAYSCALE; 
+    camera_config.frame_size = FRAMESIZE_VGA;  // set picture size, FRAMESIZE_VGA (640x480), see sensor.h
+    // camera_config.jpeg_quality = 15;           // quality of JPEG output. 0-63 lower means higher quality
+    camera_config.fb_count = fb_count;       // 1: Wait for V-Synch // 2: Continous Capture (Video)
+    if (fb_count > 1) {
+        // Frames being decoded while the next is captured
+        camera_config.fb_location = CAMERA_FB_IN_PSRAM;
+        camera_config.grab_mode = CAMERA_GRAB_LATEST;
+    }
+
+    return esp_camera_init(&camera_config);
+}
+
+static void set_flash_level(int percent) {
+    if (percent < 0) {
+        percent = 0;
+    } else if (percent > 100) {
+        percent = 100;
+    }
+    ledc_set_duty(FLASH_LEDC_MODE, FLASH_LEDC_CHANNEL,
+                  percent * ((1 << FLASH_LEDC_BITS) - 1) / 100);
+    ledc_update_duty(FLASH_LEDC_MODE, FLASH_LEDC_CHANNEL);
+}
+
+static esp_err_t setup_flash(void) {
+    ledc_timer_config_t timer = {
+        .speed_mode = FLASH_LEDC_MODE,
+        .duty_resolution = FLASH_LEDC_BITS,
+        .timer_num = FLASH_LEDC_TIMER,
+        .freq_hz = FLASH_LEDC_FREQ_HZ,
+        .clk_cfg = LEDC_AUTO_CLK,
+    };
+    ledc_channel_config_t channel = {
+        .gpio_num = flash_pin,
+        .speed_mode = FLASH_LEDC_MODE,
+        .channel = FLASH_LEDC_CHANNEL,
+        .intr_type = LEDC_INTR_DISABLE,
+        .timer_sel = FLASH_LEDC_TIMER,
+        .duty = 0,
+        .hpoint = 0,
+    };
+    esp_err_t err;
+
+    gpio_reset_pin(flash_pin);
+    err = ledc_timer_config(&timer);
+    if (err == ESP_OK) {
+        err = ledc_channel_config(&channel);
+    }
+    gpio_set_drive_capability(flash_pin, GPIO_DRIVE_CAP_0); //~10mA
+    return err;
+}
+
+static esp_err_t esp32_set_exposure(int exposure, int gain) {
+    sensor_t *s = esp_camera_sensor_get();
+    if (!s) {
+        return ESP_FAIL;
+    }
+    if (exposure < 0) {
+        s->set_exposure_ctrl(s, 1);
+        s->set_gain_ctrl(s, 1);
+        return ESP_OK;
+    }
+    if (s->set_exposure_ctrl(s, 0) || s->set_aec_value(s, exposure) ||
+        s->set_gain_ctrl(s, 0) || s->set_agc_gain(s, gain)) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static void full_window(camera_window_t *win) {
+    win->x = 0;
+    win->y = 0;
+    win->width = resolution[camera_config.frame_size].width;
+    win->height = resolution[camera_config.frame_size].height;
+    win->out_width = win->width;
+    win->out_height = win->height;
+}
+
+static esp_err_t esp32_init(int fb_count) {
+    esp_err_t err = setup_flash();
+    if (err == ESP_OK) {
+        err = setup_camera(fb_count);
+    }
+    full_window(&window);
+    prev_window = window;
+    window_since_us = 0;
+    return err;
+}
+
+static framesize_t output_framesize(int out_width) {
+    if (out_width <= 160) {
+        return FRAMESIZE_QQVGA;
+    } else if (out_width <= 320) {
+        return FRAMESIZE_QVGA;
+    }
+    return FRAMESIZE_VGA;
+}
+
+// The OV2640 produces VGA from its 800x600 SVGA sensor mode, so windows
+// are programmed in SVGA pixels, 5/4 of a full-frame pixel. set_framesize
+// first, so the driver knows the output size of the frames that follow.
+// Other sensors can only change the output size of the full view.
+static esp_err_t esp32_set_window(const camera_window_t *win) {
+    sensor_t *s = esp_camera_sensor_get();
+    camera_window_t next;
+
+    if (!s) {
+        return ESP_FAIL;
+    }
+    if (win) {
+        next = *win;
+    } else {
+        full_window(&next);
+    }
+
+    if (s->set_framesize(s, output_framesize(next.out_width))) {
+        return ESP_FAIL;
+    }
+    if (s->id.PID == OV2640_PID && s->set_res_raw) {
+        if (s->set_res_raw(s, 1 /* OV2640_MODE_SVGA */, 0, 0, 0,
+                           next.x * 5 / 4, next.y * 5 / 4,
+                           next.width * 5 / 4, next.height * 5 / 4,
+                           next.out_width, next.out_height, false, false)) {
+            return ESP_FAIL;
+        }
+    } else {
+        int out_width = next.out_width;
+        int out_height = next.out_height;
+        full_window(&next);
+        next.out_width = out_width;
+        next.out_height = out_height;
+    }
+    ESP_LOGI(TAG, "Window %dx%d+%d+%d at %dx%d", next.width, next.height,
+             next.x, next.y, next.out_width, next.out_height);
+
+    portENTER_CRITICAL(&window_lock);
+    prev_window = window;
+    window = next;
+    window_since_us = esp_timer_get_time();
+    portEXIT_CRITICAL(&window_lock);
+    return ESP_OK;
+}
+
+static void esp32_get_full_size(int *width, int *height) {
+    *width = resolution[camera_config.frame_size].width;
+    *height = resolution[camera_config.frame_size].height;
+}
+
+// With several frame buffers the driver captures ahead, so the frame
+// handed out may have started before the last set_window. The driver
+// stamps each frame with its start on the esp_timer clock.
+static esp_err_t esp32_get(camera_frame_t *frame) {
+    camera_fb_t *fb = esp_camera_fb_get();
+    if (!fb) {
+        ESP_LOGI(TAG, "Camera capture failed");
+        return ESP_FAIL;
+    }
+    int64_t started_us = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+    frame->buf = fb->buf;
+    frame->width = fb->width;
+    frame->height = fb->height;
+    portENTER_CRITICAL(&window_lock);
+    frame->window = started_us < window_since_us ? prev_window : window;
+    portEXIT_CRITICAL(&window_lock);
+    frame->handle = fb;
+    return ESP_OK;
+}
+
+static void esp32_put(camera_frame_t *frame) {
+    esp_camera_fb_return((camera_fb_t *)frame->handle);
+    frame->handle = NULL;
+    frame->buf = NULL;
+}
+
+const camera_source_t camera_source_esp32 = {
+    .name = "esp32-camera",
+    .init = esp32_init,
+    .get = esp32_get,
+    .put = esp32_put,
+    .set_flash = set_flash_level,
+    .set_exposure = esp32_set_exposure,
+    .set_window = esp32_set_window,
+    .get_full_size = esp32_get_full_size,
+};
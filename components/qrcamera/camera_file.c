@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include "camera_source.h"
+
+// Stand-in camera that replays a numbered sequence of binary (P5) PGM
+// files, so the full qrcamera_get path runs without a board.
+//
+// Frames are read from CONFIG_QRCAMERA_FILE_PATTERN with an increasing
+// index starting at 0, wrapping around at the first missing file. Each
+// capture takes CONFIG_QRCAMERA_FILE_FRAME_DELAY_MS. A frame captured
+// before the flash has been on for CONFIG_QRCAMERA_FILE_FLASH_LEAD_MS is
+// darkened, as the real sensor would see it. Like the driver, only
+// fb_count frames may be out at a time. Windows are applied in software
+// by cropping and nearest-neighbour scaling each file.
+//
+// Manual exposure is modelled by scaling the recorded levels with the
+// flash drive, exposure and gain, relative to full flash at
+// FILE_REF_EXPOSURE with no gain, where a file is replayed as recorded.
+
+static const char *TAG = "camera-file"; //for log
+
+#define FILE_REF_EXPOSURE 300
+
+static int max_frames;
+static int frames_out;
+static int next_index;
+static int64_t flash_on_since = -1;
+static int flash_percent;
+static bool manual_exposure;
+static int exposure_scale; // recorded levels x 1/256 at full flash
+static int full_width;
+static int full_height;
+static bool windowed;
+static camera_window_t window;
+
+static int read_header_int(FILE *f) {
+    int c;
+    int v = 0;
+
+    // Skip whitespace and comments
+    do {
+        c = fgetc(f);
+        if (c == '#') {
+            while (c != EOF && c != '\n') {
+                c = fgetc(f);
+            }
+        }
+    } while (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+
+    if (c < '0' || c > '9') {
+        return -1;
+    }
+    while (c >= '0' && c <= '9') {
+        v = v * 10 + (c - '0');
+        c = fgetc(f);
+    }
+    return v;
+}
+
+static FILE *open_frame(int index) {
+    char path[256];
+    snprintf(path, sizeof(path), CONFIG_QRCAMERA_FILE_PATTERN, index);
+    return fopen(path, "rb");
+}
+
+static esp_err_t load_pgm(FILE *f, camera_frame_t *frame) {
+    int w, h, maxval;
+
+    if (fgetc(f) != 'P' || fgetc(f) != '5') {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    w = read_header_int(f);
+    h = read_header_int(f);
+    maxval = read_header_int(f);
+    if (w <= 0 || h <= 0 || maxval <= 0 || maxval > 255) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    frame->buf = malloc(w * h);
+    if (!frame->buf) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (fread(frame->buf, 1, w * h, f) != (size_t)(w * h)) {
+        free(frame->buf);
+        frame->buf = NULL;
+        return ESP_ERR_INVALID_SIZE;
+    }
+    frame->width = w;
+    frame->height = h;
+    frame->handle = frame->buf;
+    return ESP_OK;
+}
+
+// Crop and scale a full frame to the current window, in place
+static void apply_window(camera_frame_t *frame, const camera_window_t *win) {
+    int x, y;
+
+    for (y = 0; y < win->out_height; y++) {
+        const uint8_t *src = frame->buf +
+            (win->y + y * win->height / win->out_height) * frame->width + win->x;
+        uint8_t *dst = frame->buf + y * win->out_width;
+        for (x = 0; x < win->out_width; x++) {
+            dst[x] = src[x * win->width / win->out_width];
+        }
+    }
+    frame->width = win->out_width;
+    frame->height = win->out_height;
+}
+
+static esp_err_t file_init(int fb_count) {
+    FILE *f = open_frame(0);
+    if (!f) {
+        ESP_LOGE(TAG, "No frames at " CONFIG_QRCAMERA_FILE_PATTERN, 0);
+        return ESP_ERR_NOT_FOUND;
+    }
+    camera_frame_t first;
+    esp_err_t err = load_pgm(f, &first);
+    fclose(f);
+    if (err != ESP_OK) {
+        return err;
+    }
+    full_width = first.width;
+    full_height = first.height;
+    free(first.buf);
+    windowed = false;
+    max_frames = fb_count;
+    frames_out = 0;
+    next_index = 0;
+    return ESP_OK;
+}
+
+static esp_err_t file_get(camera_frame_t *frame) {
+    int64_t start = esp_timer_get_time();
+    camera_frame_t loaded;
+    esp_err_t err;
+    FILE *f;
+
+    if (frames_out >= max_frames) {
+        ESP_LOGE(TAG, "All %d frame buffers in use", max_frames);
+        return ESP_FAIL;
+    }
+
+    vTaskDelay(pdMS_TO_TICKS(CONFIG_QRCAMERA_FILE_FRAME_DELAY_MS));
+
+    f = open_frame(next_index);
+    if (!f && next_index) {
+        next_index = 0;
+        f = open_frame(next_index);
+    }
+    if (!f) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    err = load_pgm(f, &loaded);
+    fclose(f);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Bad frame %d: %s", next_index, esp_err_to_name(err));
+        return err;
+    }
+    next_index++;
+
+    int scale = 256;
+    if (manual_exposure) {
+        scale = exposure_scale * flash_percent / 100;
+    }
+    if (flash_on_since < 0 ||
+        start - flash_on_since < CONFIG_QRCAMERA_FILE_FLASH_LEAD_MS * 1000) {
+        scale /= 4;
+    }
+    if (scale != 256) {
+        size_t i;
+        for (i = 0; i < loaded.width * loaded.height; i++) {
+            int v = loaded.buf[i] * scale / 256;
+            loaded.buf[i] = v > 255 ? 255 : v;
+        }
+    }
+
+    if ((int)loaded.width != full_width || (int)loaded.height != full_height) {
+        ESP_LOGE(TAG, "Frame %d is %dx%d, expected %dx%d", next_index - 1,
+                 (int)loaded.width, (int)loaded.height, full_width, full_height);
+        free(loaded.buf);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (windowed) {
+        loaded.window = window;
+        apply_window(&loaded, &window);
+    } else {
+        loaded.window.x = 0;
+        loaded.window.y = 0;
+        loaded.window.width = full_width;
+        loaded.window.height = full_height;
+        loaded.window.out_width = full_width;
+        loaded.window.out_height = full_height;
+    }
+
+    *frame = loaded;
+    frames_out++;
+    return ESP_OK;
+}
+
+static void file_put(camera_frame_t *frame) {
+    free(frame->handle);
+    frame->handle = NULL;
+    frame->buf = NULL;
+    frames_out--;
+}
+
+static void file_set_flash(int percent) {
+    flash_percent = percent;
+    if (percent <= 0) {
+        flash_on_since = -1;
+    } else if (flash_on_since < 0) {
+        flash_on_since = esp_timer_get_time();
+    }
+}
+
+static esp_err_t file_set_exposure(int exposure, int gain) {
+    // Auto exposure replays as recorded, whatever the flash level
+    manual_exposure = exposure >= 0;
+    exposure_scale = 256 * exposure / FILE_REF_EXPOSURE * (16 + gain) / 16;
+    return ESP_OK;
+}
+
+static esp_err_t file_set_window(const camera_window_t *win) {
+    if (!win) {
+        windowed = false;
+        return ESP_OK;
+    }
+    if (win->x < 0 || win->y < 0 ||
+        win->x + win->width > full_width || win->y + win->height > full_height ||
+        win->out_width > win->width || win->out_height > win->height) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    window = *win;
+    windowed = true;
+    return ESP_OK;
+}
+
+static void file_get_full_size(int *width, int *height) {
+    *width = full_width;
+    *height = full_height;
+}
+
+const camera_source_t camera_source_file = {
+    .name = "file",
+    .init = file_init,
+    .get = file_get,
+    .put = file_put,
+    .set_flash = file_set_flash,
+    .set_exposure = file_set_exposure,
+    .set_window = file_set_window,
+    .get_full_size = file_get_full_size,
+};
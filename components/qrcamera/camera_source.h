@@ -0,0 +1,59 @@
+#ifndef __TANGIBLE_CAMERA_SOURCE_H__
+#define __TANGIBLE_CAMERA_SOURCE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Region of the full sensor view, in full-frame pixels, and the frame
+// size it is captured at. Output sizes are the 4:3 standard frame sizes
+// 160x120, 320x240 or 640x480.
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+    int out_width;
+    int out_height;
+} camera_window_t;
+
+// A captured greyscale frame. The buffer belongs to the source and must be
+// handed back with put() once processed; handle is private to the source.
+// window tells which part of the full view the frame shows.
+typedef struct {
+    uint8_t *buf;
+    size_t width;
+    size_t height;
+    camera_window_t window;
+    void *handle;
+} camera_frame_t;
+
+// Frame source behind qrcamera_setup/qrcamera_get.
+// get() blocks until a frame is available and returns ESP_OK, or an error
+// if no frame could be captured (the frame is then untouched).
+typedef struct {
+    const char *name;
+    esp_err_t (*init)(int fb_count);
+    esp_err_t (*get)(camera_frame_t *frame);
+    void (*put)(camera_frame_t *frame);
+    // Flash drive in percent, 0 is off
+    void (*set_flash)(int percent);
+    // Manual exposure (sensor AEC lines, 0-1200) and analog gain (0-30);
+    // a negative exposure returns both to automatic control
+    esp_err_t (*set_exposure)(int exposure, int gain);
+    // Capture only part of the view from the next frame on; NULL restores
+    // the full frame. A frame the source started capturing before the
+    // call still comes back with the old window in frame.window.
+    esp_err_t (*set_window)(const camera_window_t *window);
+    void (*get_full_size)(int *width, int *height);
+} camera_source_t;
+
+// esp32-camera driver with the flash LED on GPIO 4, dimmed by LEDC PWM
+extern const camera_source_t camera_source_esp32;
+
+// Replays PGM files, see CONFIG_QRCAMERA_FILE_*
+extern const camera_source_t camera_source_file;
+
+#endif
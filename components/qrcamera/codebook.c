@@ -0,0 +1,137 @@
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "codebook.h"
+
+static const char *TAG = "codebook"; //for log
+
+// Thresholds relative to the number of cells in the grid.
+// Best entry must be within MAX_ERROR, and every other entry of the same
+// size must be at least MARGIN further away.
+#define CODEBOOK_MAX_ERROR_PERMILLE 150
+#define CODEBOOK_MARGIN_PERMILLE    100
+
+static const uint8_t *cb_blob = NULL;
+static size_t cb_len = 0;
+static int cb_count = 0;
+
+static inline int bitmap_bytes(int size) {
+    return (size * size + 7) / 8;
+}
+
+int codebook_load(const uint8_t *blob, size_t len) {
+    size_t pos = 6;
+    int count;
+    int i;
+
+    cb_blob = NULL;
+    cb_len = 0;
+    cb_count = 0;
+
+    if (!blob || len < pos || memcmp(blob, CODEBOOK_MAGIC, 4)) {
+        ESP_LOGI(TAG, "Invalid codebook header");
+        return -1;
+    }
+    count = blob[4] | (blob[5] << 8);
+
+    // Walk all entries once, so matching can trust the layout
+    for (i = 0; i < count; i++) {
+        int size, payload_len;
+        if (pos + 2 > len) {
+            break;
+        }
+        size = blob[pos];
+        payload_len = blob[pos + 1];
+        if (size < 21 || size > QUIRC_MAX_GRID_SIZE || (size - 17) % 4) {
+            break;
+        }
+        pos += 2 + payload_len + bitmap_bytes(size);
+        if (pos > len) {
+            break;
+        }
+    }
+    if (i != count) {
+        ESP_LOGI(TAG, "Codebook truncated at entry %d of %d", i, count);
+        return -1;
+    }
+
+    cb_blob = blob;
+    cb_len = pos;
+    cb_count = count;
+    ESP_LOGI(TAG, "Loaded %d codebook entries (%d bytes)", cb_count, (int)cb_len);
+    return 0;
+}
+
+int codebook_count(void) {
+    return cb_count;
+}
+
+static int bitmap_distance(const uint8_t *a, const uint8_t *b, int n) {
+    int d = 0;
+    while (n--) {
+        d += __builtin_popcount(*a++ ^ *b++);
+    }
+    return d;
+}
+
+int codebook_match(const struct quirc_code *code, char *out, size_t out_size,
+                   int *dist) {
+    const int cells = code->size * code->size;
+    const int n = bitmap_bytes(code->size);
+    const uint8_t *best_payload = NULL;
+    int best_len = 0;
+    int best = cells + 1;
+    int second = cells + 1;
+    size_t pos = 6;
+    int i;
+
+    if (dist) {
+        *dist = -1;
+    }
+    if (!cb_count) {
+        return 0;
+    }
+
+    for (i = 0; i < cb_count; i++) {
+        int size = cb_blob[pos];
+        int payload_len = cb_blob[pos + 1];
+        const uint8_t *payload = cb_blob + pos + 2;
+
+        pos += 2 + payload_len + bitmap_bytes(size);
+        if (size != code->size) {
+            continue;
+        }
+
+        int d = bitmap_distance(code->cell_bitmap, payload + payload_len, n);
+        if (d < best) {
+            second = best;
+            best = d;
+            best_payload = payload;
+            best_len = payload_len;
+        } else if (d < second) {
+            second = d;
+        }
+    }
+
+    if (!best_payload) {
+        return 0;
+    }
+    if (dist) {
+        *dist = best;
+    }
+    if (best * 1000 > cells * CODEBOOK_MAX_ERROR_PERMILLE) {
+        return 0;
+    }
+    if ((second - best) * 1000 < cells * CODEBOOK_MARGIN_PERMILLE) {
+        ESP_LOGI(TAG, "Ambiguous codebook match: %d vs %d", best, second);
+        return 0;
+    }
+    if ((size_t)best_len >= out_size) {
+        return 0;
+    }
+
+    memcpy(out, best_payload, best_len);
+    out[best_len] = 0;
+    return 1;
+}
@@ -0,0 +1,38 @@
+#ifndef __TANGIBLE_CODEBOOK_H__
+#define __TANGIBLE_CODEBOOK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "quirc.h"
+
+// Codebook of known cards, matched directly against the extracted cell
+// bitmap so that known cards skip format/data ECC and payload decoding.
+//
+// Blob layout (little endian), as produced by tools/make_codebook.py:
+//   "TGCB"            magic
+//   u16 count         number of entries
+//   count x entry:
+//     u8  size        grid size (cells across)
+//     u8  payload_len
+//     payload_len     payload bytes (no terminator)
+//     (size*size+7)/8 cell bitmap, same bit order as quirc_code.cell_bitmap
+//
+// The blob is used in place, so it may live in memory-mapped flash.
+
+#define CODEBOOK_MAGIC "TGCB"
+
+// Returns 0 if the blob is well formed, -1 otherwise
+int codebook_load(const uint8_t *blob, size_t len);
+
+// Number of loaded entries
+int codebook_count(void);
+
+// Match an extracted code against the codebook.
+// 1: unique match, payload copied to out (nul terminated)
+// 0: no confident match, fall back to the full decoder
+// Hamming distance of the best entry is returned in *dist if non-NULL.
+int codebook_match(const struct quirc_code *code, char *out, size_t out_size,
+                   int *dist);
+
+#endif
@@ -31,22 +31,6 @@ struct galois_field {
 	const uint8_t *exp;
 };
 
-static const uint8_t gf16_exp[16] = {
-	0x01, 0x02, 0x04, 0x08, 0x03, 0x06, 0x0c, 0x0b,
-	0x05, 0x0a, 0x07, 0x0e, 0x0f, 0x0d, 0x09, 0x01
-};
-
-static const uint8_t gf16_log[16] = {
-	0x00, 0x0f, 0x01, 0x04, 0x02, 0x08, 0x05, 0x0a,
-	0x03, 0x0e, 0x09, 0x07, 0x06, 0x0d, 0x0b, 0x0c
-};
-
-static const struct galois_field gf16 = {
-	.p = 15,
-	.log = gf16_log,
-	.exp = gf16_exp
-};
-
 static const uint8_t gf256_exp[256] = {
 	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
 	0x1d, 0x3a, 0x74, 0xe8, 0xcd, 0x87, 0x13, 0x26,
@@ -292,7 +276,8 @@ static void eloc_poly(uint8_t *omega,
 }
 
 static quirc_decode_error_t correct_block(uint8_t *data,
-					  const struct quirc_rs_params *ecc)
+					  const struct quirc_rs_params *ecc,
+					  int *corrected)
 {
 	int npar = ecc->bs - ecc->dw;
 	uint8_t s[MAX_POLY];
@@ -301,6 +286,8 @@ static quirc_decode_error_t correct_block(uint8_t *data,
 	uint8_t omega[MAX_POLY];
 	int i;
 
+	*corrected = 0;
+
 	/* Compute syndrome vector */
 	if (!block_syndromes(data, ecc->bs, npar, s))
 		return QUIRC_SUCCESS;
@@ -326,6 +313,7 @@ static quirc_decode_error_t correct_block(uint8_t *data,
 						   gf256_log[omega_x]) % 255];
 
 			data[ecc->bs - i - 1] ^= error;
+			(*corrected)++;
 		}
 	}
 
@@ -338,60 +326,75 @@ static quirc_decode_error_t correct_block(uint8_t *data,
 /************************************************************************
  * Format value error correction
  *
- * Generator polynomial for GF(2^4) is x^4 + x + 1
+ * There are only 32 valid format codewords (BCH(15,5), generator
+ * x^10 + x^8 + x^5 + x^4 + x^2 + x + 1), so instead of solving for the
+ * error locator we simply pick the codeword nearest to the observed
+ * copy. Indexed by the 5 data bits, before masking with 0x5412.
  */
 
 #define FORMAT_MAX_ERROR        3
-#define FORMAT_SYNDROMES        (FORMAT_MAX_ERROR * 2)
-#define FORMAT_BITS             15
+#define FORMAT_CODEWORDS        32
 
-static int format_syndromes(uint16_t u, uint8_t *s)
+static const uint16_t format_codewords[FORMAT_CODEWORDS] = {
+	0x0000, 0x0537, 0x0a6e, 0x0f59, 0x11eb, 0x14dc, 0x1b85, 0x1eb2,
+	0x23d6, 0x26e1, 0x29b8, 0x2c8f, 0x323d, 0x370a, 0x3853, 0x3d64,
+	0x429b, 0x47ac, 0x48f5, 0x4dc2, 0x5370, 0x5647, 0x591e, 0x5c29,
+	0x614d, 0x647a, 0x6b23, 0x6e14, 0x70a6, 0x7591, 0x7ac8, 0x7fff
+};
+
+/* Find the codeword nearest to one (unmasked) copy u.
+ *
+ * Returns the format data (0..31) if it is within FORMAT_MAX_ERROR bits
+ * and no other codeword is as close, -1 otherwise.
+ */
+static int nearest_format(uint16_t u)
 {
+	int best = -1;
+	int best_dist = 16;
+	int second_dist = 16;
 	int i;
-	int nonzero = 0;
 
-	memset(s, 0, MAX_POLY);
+	for (i = 0; i < FORMAT_CODEWORDS; i++) {
+		const int d = __builtin_popcount(format_codewords[i] ^ u);
 
-	for (i = 0; i < FORMAT_SYNDROMES; i++) {
-		int j;
-
-		s[i] = 0;
-		for (j = 0; j < FORMAT_BITS; j++)
-			if (u & (1 << j))
-				s[i] ^= gf16_exp[((i + 1) * j) % 15];
-
-		if (s[i])
-			nonzero = 1;
+		if (d < best_dist) {
+			second_dist = best_dist;
+			best_dist = d;
+			best = i;
+		} else if (d < second_dist) {
+			second_dist = d;
+		}
 	}
 
-	return nonzero;
+	if (best_dist > FORMAT_MAX_ERROR || second_dist == best_dist)
+		return -1;
+
+	return best;
 }
 
-static quirc_decode_error_t correct_format(uint16_t *f_ret)
+/* Find the format data of the two (unmasked) copies u0 and u1.
+ *
+ * Each copy is matched on its own, the first one first, as upstream.
+ * Scoring the copies together gains nothing: the codewords are at least
+ * 7 bits apart, so a pair within 6 bits always has one copy within 3.
+ * And when the copies disagree, the summed distance can favour an
+ * unreadable copy that happens to lie near another codeword.
+ *
+ * Returns the format data (0..31) and its distance to both copies
+ * together in *dist_ret, or -1 if neither copy is close enough.
+ */
+static int correct_format(uint16_t u0, uint16_t u1, int *dist_ret)
 {
-	uint16_t u = *f_ret;
-	int i;
-	uint8_t s[MAX_POLY];
-	uint8_t sigma[MAX_POLY];
-
-	/* Evaluate U (received codeword) at each of alpha_1 .. alpha_6
-	 * to get S_1 .. S_6 (but we index them from 0).
-	 */
-	if (!format_syndromes(u, s))
-		return QUIRC_SUCCESS;
-
-	berlekamp_massey(s, FORMAT_SYNDROMES, &gf16, sigma);
+	int fdata = nearest_format(u0);
 
-	/* Now, find the roots of the polynomial */
-	for (i = 0; i < 15; i++)
-		if (!poly_eval(sigma, gf16_exp[15 - i], &gf16))
-			u ^= (1 << i);
-
-	if (format_syndromes(u, s))
-		return QUIRC_ERROR_FORMAT_ECC;
+	if (fdata < 0)
+		fdata = nearest_format(u1);
+	if (fdata < 0)
+		return -1;
 
-	*f_ret = u;
-	return QUIRC_SUCCESS;
+	*dist_ret = __builtin_popcount(format_codewords[fdata] ^ u0) +
+		    __builtin_popcount(format_codewords[fdata] ^ u1);
+	return fdata;
 }
 
 /************************************************************************
@@ -413,41 +416,39 @@ static inline int grid_bit(const struct quirc_code *code, int x, int y)
 }
 
 static quirc_decode_error_t read_format(const struct quirc_code *code,
-					struct quirc_data *data, int which)
+					struct quirc_data *data)
 {
+	static const int xs[15] = {
+		8, 8, 8, 8, 8, 8, 8, 8, 7, 5, 4, 3, 2, 1, 0
+	};
+	static const int ys[15] = {
+		0, 1, 2, 3, 4, 5, 7, 8, 8, 8, 8, 8, 8, 8, 8
+	};
+	uint16_t format0 = 0;
+	uint16_t format1 = 0;
+	int fdata;
+	int dist;
 	int i;
-	uint16_t format = 0;
-	uint16_t fdata;
-	quirc_decode_error_t err;
 
-	if (which) {
-		for (i = 0; i < 7; i++)
-			format = (format << 1) |
-				grid_bit(code, 8, code->size - 1 - i);
-		for (i = 0; i < 8; i++)
-			format = (format << 1) |
-				grid_bit(code, code->size - 8 + i, 8);
-	} else {
-		static const int xs[15] = {
-			8, 8, 8, 8, 8, 8, 8, 8, 7, 5, 4, 3, 2, 1, 0
-		};
-		static const int ys[15] = {
-			0, 1, 2, 3, 4, 5, 7, 8, 8, 8, 8, 8, 8, 8, 8
-		};
-
-		for (i = 14; i >= 0; i--)
-			format = (format << 1) | grid_bit(code, xs[i], ys[i]);
-	}
+	/* Copy next to the top-left capstone */
+	for (i = 14; i >= 0; i--)
+		format0 = (format0 << 1) | grid_bit(code, xs[i], ys[i]);
 
-	format ^= 0x5412;
+	/* Copy split between the bottom-left and top-right capstones */
+	for (i = 0; i < 7; i++)
+		format1 = (format1 << 1) |
+			grid_bit(code, 8, code->size - 1 - i);
+	for (i = 0; i < 8; i++)
+		format1 = (format1 << 1) |
+			grid_bit(code, code->size - 8 + i, 8);
 
-	err = correct_format(&format);
-	if (err)
-		return err;
+	fdata = correct_format(format0 ^ 0x5412, format1 ^ 0x5412, &dist);
+	if (fdata < 0)
+		return QUIRC_ERROR_FORMAT_ECC;
 
-	fdata = format >> 10;
 	data->ecc_level = fdata >> 3;
 	data->mask = fdata & 7;
+	data->format_distance = dist;
 
 	return QUIRC_SUCCESS;
 }
@@ -569,7 +570,8 @@ static void read_data(const struct quirc_code *code,
 }
 
 static quirc_decode_error_t codestream_ecc(struct quirc_data *data,
-					   struct datastream *ds)
+					   struct datastream *ds,
+					   struct quirc_diag *diag)
 {
 	const struct quirc_version_info *ver =
 		&quirc_version_db[data->version];
@@ -586,12 +588,18 @@ static quirc_decode_error_t codestream_ecc(struct quirc_data *data,
 	lb_ecc.dw++;
 	lb_ecc.bs++;
 
+	if (diag) {
+		diag->ecc_capacity = (sb_ecc->bs - sb_ecc->dw) / 2;
+		diag->num_blocks = bc;
+	}
+
 	for (i = 0; i < bc; i++) {
 		uint8_t *dst = ds->data + dst_offset;
 		const struct quirc_rs_params *ecc =
 		    (i < sb_ecc->ns) ? sb_ecc : &lb_ecc;
 		const int num_ec = ecc->bs - ecc->dw;
 		quirc_decode_error_t err;
+		int corrected;
 		int j;
 
 		for (j = 0; j < ecc->dw; j++)
@@ -599,7 +607,9 @@ static quirc_decode_error_t codestream_ecc(struct quirc_data *data,
 		for (j = 0; j < num_ec; j++)
 			dst[ecc->dw + j] = ds->raw[ecc_offset + j * bc + i];
 
-		err = correct_block(dst, ecc);
+		err = correct_block(dst, ecc, &corrected);
+		if (diag)
+			diag->block_errors[i] = corrected;
 		if (err)
 			return err;
 
@@ -882,10 +892,23 @@ done:
 
 quirc_decode_error_t quirc_decode(const struct quirc_code *code,
 				  struct quirc_data *data)
+{
+	return quirc_decode_diag(code, data, NULL);
+}
+
+quirc_decode_error_t quirc_decode_diag(const struct quirc_code *code,
+				       struct quirc_data *data,
+				       struct quirc_diag *diag)
 {
 	quirc_decode_error_t err;
 	struct datastream ds;
 
+	if (diag) {
+		diag->format_distance = -1;
+		diag->ecc_capacity = 0;
+		diag->num_blocks = 0;
+	}
+
 	if ((code->size - 17) % 4)
 		return QUIRC_ERROR_INVALID_GRID_SIZE;
 
@@ -898,15 +921,15 @@ quirc_decode_error_t quirc_decode(const struct quirc_code *code,
 	    data->version > QUIRC_MAX_VERSION)
 		return QUIRC_ERROR_INVALID_VERSION;
 
-	/* Read format information -- try both locations */
-	err = read_format(code, data, 0);
-	if (err)
-		err = read_format(code, data, 1);
+	/* Read format information -- both locations at once */
+	err = read_format(code, data);
 	if (err)
 		return err;
+	if (diag)
+		diag->format_distance = data->format_distance;
 
 	read_data(code, data, &ds);
-	err = codestream_ecc(data, &ds);
+	err = codestream_ecc(data, &ds, diag);
 	if (err)
 		return err;
 
@@ -0,0 +1,123 @@
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#include "esp_log.h"
+
+#include "exposure.h"
+
+static const char *TAG = "exposure"; //for log
+
+typedef struct {
+    uint8_t flash;      // percent
+    uint16_t exposure;  // sensor AEC lines
+    uint8_t gain;
+} exposure_step_t;
+
+// Roughly 1.4x more light per step. Flash first, as it also freezes
+// motion, then exposure time, and gain (noise) only as a last resort.
+static const exposure_step_t ladder[] = {
+    {  20,  150,  0 },
+    {  35,  150,  0 },
+    {  50,  300,  0 },
+    {  70,  300,  0 },
+    { 100,  300,  0 },
+    { 100,  450,  0 },
+    { 100,  600,  0 },
+    { 100,  900,  0 },
+    { 100, 1200,  0 },
+    { 100, 1200,  8 },
+    { 100, 1200, 16 },
+};
+
+#define LADDER_STEPS ((int)(sizeof(ladder) / sizeof(ladder[0])))
+#define LADDER_START 4
+
+// A frame this much darker than the reference was not lit by the flash
+#define UNLIT_PERCENT 75
+#define LEAD_BACKOFF_MS 4
+// Good reads to wait after a backoff before probing shorter lead times
+#define LEAD_HOLD_READS 16
+
+static const camera_source_t *cam;
+static int level;
+static int lead_ms;
+static int lead_hold;
+static int ref_light;   // light level of the last good frame at this level
+
+static void apply_level(int next) {
+    level = next;
+    ref_light = 0;
+    if (cam->set_exposure(ladder[level].exposure, ladder[level].gain) != ESP_OK) {
+        ESP_LOGW(TAG, "Could not set exposure %d, gain %d",
+                 ladder[level].exposure, ladder[level].gain);
+    }
+}
+
+esp_err_t exposure_init(const camera_source_t *source) {
+    cam = source;
+    lead_ms = CONFIG_QRCAMERA_FLASH_LEAD_MS;
+    lead_hold = 0;
+    level = LADDER_START;
+    ref_light = 0;
+    return cam->set_exposure(ladder[level].exposure, ladder[level].gain);
+}
+
+void exposure_restore(void) {
+    if (cam->set_exposure(ladder[level].exposure, ladder[level].gain) != ESP_OK) {
+        ESP_LOGW(TAG, "Could not restore exposure %d, gain %d",
+                 ladder[level].exposure, ladder[level].gain);
+    }
+}
+
+int exposure_flash_percent(void) {
+    return ladder[level].flash;
+}
+
+int exposure_lead_ms(void) {
+    return lead_ms;
+}
+
+bool exposure_update(const struct quirc_exposure *exp, int res, bool lead_timed) {
+    int contrast = exp->light_mean - exp->dark_mean;
+    int prev = level;
+
+    if (lead_timed && ref_light &&
+        exp->light_mean * 100 < ref_light * UNLIT_PERCENT &&
+        lead_ms < CONFIG_QRCAMERA_FLASH_LEAD_MAX_MS) {
+        // Captured before the flash was up; says nothing about exposure
+        lead_ms += LEAD_BACKOFF_MS;
+        if (lead_ms > CONFIG_QRCAMERA_FLASH_LEAD_MAX_MS) {
+            lead_ms = CONFIG_QRCAMERA_FLASH_LEAD_MAX_MS;
+        }
+        lead_hold = LEAD_HOLD_READS;
+        ESP_LOGI(TAG, "Unlit frame, flash lead %d ms", lead_ms);
+        return false;
+    }
+
+    if (exp->clipped_high > CONFIG_QRCAMERA_EXPOSURE_CLIP_LIMIT ||
+        contrast > CONFIG_QRCAMERA_EXPOSURE_CONTRAST_MAX) {
+        if (level > 0) {
+            apply_level(level - 1);
+        }
+    } else if (contrast < CONFIG_QRCAMERA_EXPOSURE_CONTRAST_MIN) {
+        if (level < LADDER_STEPS - 1) {
+            apply_level(level + 1);
+        }
+    } else if (lead_timed) {
+        // In band: the reference for unlit frames, and a chance to probe
+        ref_light = exp->light_mean;
+        if (lead_hold) {
+            lead_hold--;
+        } else if (res == 1 && lead_ms > 0) {
+            lead_ms--;
+        }
+    }
+
+    if (level != prev) {
+        ESP_LOGI(TAG, "Contrast %d, clipped %d/1000: flash %d%%, exposure %d, gain %d",
+                 contrast, exp->clipped_high, ladder[level].flash,
+                 ladder[level].exposure, ladder[level].gain);
+    }
+    return ladder[level].flash != ladder[prev].flash;
+}
@@ -0,0 +1,40 @@
+#ifndef __TANGIBLE_EXPOSURE_H__
+#define __TANGIBLE_EXPOSURE_H__
+
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+#include "quirc.h"
+#include "camera_source.h"
+
+// Closed-loop flash and exposure control, see CONFIG_QRCAMERA_EXPOSURE_CONTROL.
+//
+// Exposure is stepped along a fixed ladder of flash drive, sensor exposure
+// and gain settings, using the histogram statistics of each processed frame,
+// so that the grey-level gap between dark and light modules stays within
+// the configured contrast band without clipping the highlights.
+//
+// The flash lead time (flash on until capture) is learned as well: after
+// good frames it is shortened step by step, and it is lengthened again as
+// soon as a frame comes out clearly darker than the last good one at the
+// same settings, i.e. exposed before the flash was up.
+
+// Apply the initial settings to the source
+esp_err_t exposure_init(const camera_source_t *source);
+
+// Apply the current settings again, after something else (the presence
+// preview) has changed the sensor exposure
+void exposure_restore(void);
+
+// Settings for the next capture
+int exposure_flash_percent(void);
+int exposure_lead_ms(void);
+
+// Feed back the statistics of a processed frame and its qrcamera_get
+// result. lead_timed is false if the flash was already on before the
+// capture (pipeline), so the frame says nothing about the lead time.
+// Returns true if the flash drive changed.
+bool exposure_update(const struct quirc_exposure *exp, int res, bool lead_timed);
+
+#endif
@@ -0,0 +1,178 @@
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "framegate.h"
+
+#define SAMPLE_STRIDE 4
+#define FINDER_ROW_STRIDE 8
+// Fewer edge samples than this and sharpness cannot be judged
+#define MIN_EDGE_SAMPLES 16
+
+const char *framegate_str(qrcamera_gate_t gate) {
+    switch (gate) {
+    case QRCAMERA_GATE_PASS:
+        return "pass";
+    case QRCAMERA_GATE_CLIPPED:
+        return "clipped";
+    case QRCAMERA_GATE_LOW_CONTRAST:
+        return "low contrast";
+    case QRCAMERA_GATE_BLURRED:
+        return "blurred";
+    case QRCAMERA_GATE_NO_FINDER:
+        return "no finder pattern";
+    }
+    return "unknown";
+}
+
+// Run lengths dark, light, dark, light, dark in ratio 1:1:3:1:1, each
+// within half a module
+static int is_finder(const int *runs) {
+    static const int ratio[5] = {1, 1, 3, 1, 1};
+    int total = 0;
+    int i;
+
+    for (i = 0; i < 5; i++) {
+        total += runs[i];
+    }
+    if (total < 7) {
+        return 0;
+    }
+    for (i = 0; i < 5; i++) {
+        int diff = runs[i] * 7 - total * ratio[i];
+        if (diff < 0) {
+            diff = -diff;
+        }
+        if (diff * 2 > total) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int row_has_finder(const uint8_t *row, int w, int threshold) {
+    int runs[5] = {0};
+    int last = row[0] < threshold;
+    int len = 1;
+    int x;
+
+    for (x = 1; x <= w; x++) {
+        // Force the final run to end at the edge of the frame
+        int dark = x < w ? row[x] < threshold : !last;
+        if (dark == last) {
+            len++;
+            continue;
+        }
+        memmove(runs, runs + 1, 4 * sizeof(runs[0]));
+        runs[4] = len;
+        if (last && runs[0] && is_finder(runs)) {
+            return 1;
+        }
+        last = dark;
+        len = 1;
+    }
+    return 0;
+}
+
+qrcamera_gate_t framegate_check(const uint8_t *buf, int w, int h,
+                                struct quirc_exposure *exp,
+                                framegate_metrics_t *metrics) {
+    unsigned int histogram[256];
+    unsigned int steps[2][256]; // horizontal, vertical
+    unsigned int samples = 0;
+    int i, x, y;
+
+    memset(histogram, 0, sizeof(histogram));
+    memset(steps, 0, sizeof(steps));
+    memset(exp, 0, sizeof(*exp));
+    metrics->sharpness = 0;
+    metrics->finder_rows = 0;
+
+    // The sample phase shifts from row to row, and the row of the
+    // vertical step from column to column, so that module edges on a
+    // multiple of the stride are not missed
+    for (y = 0; y < h - SAMPLE_STRIDE; y += SAMPLE_STRIDE) {
+        const uint8_t *row = buf + y * w;
+        for (x = (y / SAMPLE_STRIDE) % SAMPLE_STRIDE; x < w - 1; x += SAMPLE_STRIDE) {
+            const uint8_t *v = row + ((x / SAMPLE_STRIDE) % SAMPLE_STRIDE) * w + x;
+            int dx = row[x + 1] - row[x];
+            int dy = v[w] - v[0];
+            histogram[row[x]]++;
+            steps[0][dx < 0 ? -dx : dx]++;
+            steps[1][dy < 0 ? -dy : dy]++;
+        }
+    }
+    for (i = 0; i < 256; i++) {
+        samples += histogram[i];
+    }
+    if (!samples) {
+        return QRCAMERA_GATE_LOW_CONTRAST;
+    }
+
+    // Otsu split of the sample histogram, as identification will do on
+    // the full frame
+    {
+        unsigned int sum = 0, dark_sum = 0, dark = 0;
+        double best = 0;
+        for (i = 0; i < 256; i++) {
+            sum += i * histogram[i];
+        }
+        exp->mean = sum / samples;
+        exp->dark_mean = exp->mean;
+        exp->light_mean = exp->mean;
+        for (i = 0; i < 255; i++) {
+            dark += histogram[i];
+            dark_sum += i * histogram[i];
+            if (!dark || dark == samples) {
+                continue;
+            }
+            double m1 = (double)dark_sum / dark;
+            double m2 = (double)(sum - dark_sum) / (samples - dark);
+            double variance = (m2 - m1) * (m2 - m1) * dark * (samples - dark);
+            if (variance > best) {
+                best = variance;
+                exp->threshold = i + 1;
+                exp->dark_mean = (int)m1;
+                exp->light_mean = (int)m2;
+            }
+        }
+        exp->clipped_low = histogram[0] * 1000 / samples;
+        exp->clipped_high = histogram[255] * 1000 / samples;
+    }
+    int contrast = exp->light_mean - exp->dark_mean;
+
+    if (exp->clipped_high > CONFIG_QRCAMERA_GATE_MAX_CLIPPED) {
+        return QRCAMERA_GATE_CLIPPED;
+    }
+    if (contrast < CONFIG_QRCAMERA_GATE_MIN_CONTRAST) {
+        return QRCAMERA_GATE_LOW_CONTRAST;
+    }
+
+    // Motion blur is directional, so the worse direction counts
+    metrics->sharpness = 1000;
+    for (x = 0; x < 2; x++) {
+        unsigned int edges = 0, sharp = 0;
+        for (i = contrast / 8 + 1; i < 256; i++) {
+            edges += steps[x][i];
+            if (i > contrast / 2) {
+                sharp += steps[x][i];
+            }
+        }
+        if (edges < MIN_EDGE_SAMPLES) {
+            metrics->sharpness = 0;
+        } else if (sharp * 1000 / edges < (unsigned int)metrics->sharpness) {
+            metrics->sharpness = sharp * 1000 / edges;
+        }
+    }
+    if (metrics->sharpness < CONFIG_QRCAMERA_GATE_MIN_SHARPNESS) {
+        return QRCAMERA_GATE_BLURRED;
+    }
+
+    for (y = FINDER_ROW_STRIDE / 2; y < h; y += FINDER_ROW_STRIDE) {
+        metrics->finder_rows += row_has_finder(buf + y * w, w, exp->threshold);
+    }
+    if (metrics->finder_rows < CONFIG_QRCAMERA_GATE_MIN_FINDER_ROWS) {
+        return QRCAMERA_GATE_NO_FINDER;
+    }
+    return QRCAMERA_GATE_PASS;
+}
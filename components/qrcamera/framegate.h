@@ -0,0 +1,37 @@
+#ifndef __TANGIBLE_FRAMEGATE_H__
+#define __TANGIBLE_FRAMEGATE_H__
+
+#include <stdint.h>
+
+#include "quirc.h"
+#include "qrcamera.h"
+
+// Quality gate run before identification, see CONFIG_QRCAMERA_GATE.
+//
+// Looks at a strided subsample of the frame only:
+//   - contrast and clipping from a histogram of every 4th pixel of every
+//     4th row
+//   - sharpness: of the pixel steps at those samples that belong to an
+//     edge, the share in thousandths that cross half the contrast in a
+//     single pixel, in the worse of the horizontal and vertical
+//     direction. Motion or focus blur spreads edges over several pixels
+//     and drives it to 0.
+//   - finder patterns: rows where a 1:1:3:1:1 dark/light run sequence
+//     occurs, scanning every 8th row at full resolution
+//
+// The histogram statistics are returned in exp in the same form as
+// quirc_get_exposure(), so that rejected frames still drive exposure
+// control.
+
+typedef struct {
+    int sharpness;
+    int finder_rows;
+} framegate_metrics_t;
+
+qrcamera_gate_t framegate_check(const uint8_t *buf, int w, int h,
+                                struct quirc_exposure *exp,
+                                framegate_metrics_t *metrics);
+
+const char *framegate_str(qrcamera_gate_t gate);
+
+#endif
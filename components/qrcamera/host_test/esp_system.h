@@ -0,0 +1,6 @@
+#ifndef __HOST_ESP_SYSTEM_H__
+#define __HOST_ESP_SYSTEM_H__
+
+#include "esp_err.h"
+
+#endif
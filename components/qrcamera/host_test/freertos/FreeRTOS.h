@@ -0,0 +1,22 @@
+#ifndef __HOST_FREERTOS_H__
+#define __HOST_FREERTOS_H__
+
+#include <stdint.h>
+
+// Host stand-in for the parts of FreeRTOS used outside the pipeline.
+// Everything runs on the test's single thread, so critical sections
+// are no-ops. Ticks are milliseconds.
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+
+#define pdTRUE  1
+#define pdFALSE 0
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+
+#endif
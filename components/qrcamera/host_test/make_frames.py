@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+"""Write the PGM frames replayed by test_replay.c through camera_file.c.
+
+One 320x240 binary (P5) PGM per entry of FRAMES: a card lit by the flash
+on a darker, slightly textured table, or the empty table. The payloads
+are what test_replay.c expects back, in the same order.
+
+    components/qrcamera/host_test/make_frames.py components/qrcamera/host_test/frames
+
+Requires the `qrcode` package.
+"""
+import argparse
+import os
+import random
+
+import qrcode
+
+WIDTH = 320
+HEIGHT = 240
+MODULE_PX = 4
+QUIET_MODULES = 2
+
+# (payload or None for no card, top left corner of the card)
+FRAMES = [
+    ('tgbl:card-0001', (60, 40)),
+    ('tgbl:card-0002', (150, 70)),
+    (None, None),
+    ('https://example.org/tgbl/c/42', (90, 30)),
+]
+
+
+def table(rng):
+    return [[70 + rng.randrange(-8, 9) for _ in range(WIDTH)]
+            for _ in range(HEIGHT)]
+
+
+def draw_card(pixels, payload, origin, rng):
+    qr = qrcode.QRCode(error_correction=qrcode.constants.ERROR_CORRECT_M,
+                       border=QUIET_MODULES)
+    qr.add_data(payload)
+    qr.make(fit=True)
+    matrix = qr.get_matrix()
+    x0, y0 = origin
+    for y, row in enumerate(matrix):
+        for x, dark in enumerate(row):
+            level = 35 if dark else 210
+            for py in range(MODULE_PX):
+                for px in range(MODULE_PX):
+                    pixels[y0 + y * MODULE_PX + py][x0 + x * MODULE_PX + px] = \
+                        level + rng.randrange(-10, 11)
+
+
+def write_pgm(path, pixels):
+    with open(path, 'wb') as f:
+        f.write(b'P5\n%d %d\n255\n' % (WIDTH, HEIGHT))
+        f.write(bytes(v for row in pixels for v in row))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('out_dir')
+    args = parser.parse_args()
+
+    os.makedirs(args.out_dir, exist_ok=True)
+    rng = random.Random(1)
+    for i, (payload, origin) in enumerate(FRAMES):
+        pixels = table(rng)
+        if payload is not None:
+            draw_card(pixels, payload, origin, rng)
+        write_pgm(os.path.join(args.out_dir, 'frame%04d.pgm' % i), pixels)
+
+
+if __name__ == '__main__':
+    main()
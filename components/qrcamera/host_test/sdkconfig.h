@@ -0,0 +1,26 @@
+#ifndef __HOST_SDKCONFIG_H__
+#define __HOST_SDKCONFIG_H__
+
+// Configuration of the host tests: the file camera with the cards
+// profile, the frame cache (switched at run time) and presence
+// detection, otherwise the defaults of sdkconfig. Each test passes its own
+// CONFIG_QRCAMERA_FILE_PATTERN.
+#define CONFIG_QRCAMERA_SOURCE_FILE 1
+#define CONFIG_QRCAMERA_FILE_FRAME_DELAY_MS 0
+#define CONFIG_QRCAMERA_FILE_FLASH_LEAD_MS 5
+#define CONFIG_QRCAMERA_PROFILE_CARDS 1
+#define CONFIG_QRCAMERA_MAX_VERSION 6
+#define CONFIG_QRCAMERA_MAX_GRIDS 2
+#define CONFIG_QRCAMERA_MAX_CAPSTONES 12
+#define CONFIG_QRCAMERA_MAX_REGIONS 254
+#define CONFIG_QRCAMERA_CODEBOOK_FILE ""
+#define CONFIG_QRCAMERA_FLASH_LEAD_MS 10
+#define CONFIG_QRCAMERA_FRAME_CACHE 1
+#define CONFIG_QRCAMERA_FRAME_CACHE_THRESHOLD 10
+#define CONFIG_QRCAMERA_PRESENCE 1
+#define CONFIG_QRCAMERA_PRESENCE_INTERVAL_MS 50
+#define CONFIG_QRCAMERA_PRESENCE_BLOCK_THRESHOLD 16
+#define CONFIG_QRCAMERA_PRESENCE_BRIGHTNESS_THRESHOLD 24
+#define CONFIG_QRCAMERA_PRESENCE_EDGE_PERCENT 50
+
+#endif
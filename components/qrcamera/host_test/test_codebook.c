@@ -0,0 +1,185 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "codebook.h"
+
+// Version 1 codes throughout: 21x21 cells, so the match threshold is
+// 441 * 15% = 66.15 bit errors and the margin 441 * 10% = 44.1
+#define SIZE 21
+#define CELLS (SIZE * SIZE)
+#define BITMAP_BYTES ((CELLS + 7) / 8)
+
+static uint8_t blob[1024];
+static size_t blob_len;
+
+static void set_cell(uint8_t *bitmap, int i, int black) {
+    if (black) {
+        bitmap[i >> 3] |= 1 << (i & 7);
+    } else {
+        bitmap[i >> 3] &= ~(1 << (i & 7));
+    }
+}
+
+static int get_cell(const uint8_t *bitmap, int i) {
+    return (bitmap[i >> 3] >> (i & 7)) & 1;
+}
+
+// Card A's cells; B and C differ from it in the first n cells
+static void card_bitmap(uint8_t *bitmap, int inverted) {
+    int i;
+    memset(bitmap, 0, BITMAP_BYTES);
+    for (i = 0; i < CELLS; i++) {
+        set_cell(bitmap, i, (i * 7 % 3 == 0) ^ (i < inverted));
+    }
+}
+
+static void blob_start(void) {
+    memcpy(blob, CODEBOOK_MAGIC, 4);
+    blob[4] = 0;
+    blob[5] = 0;
+    blob_len = 6;
+}
+
+static void blob_add(int size, const char *payload, int inverted) {
+    size_t len = strlen(payload);
+    blob[blob_len++] = size;
+    blob[blob_len++] = len;
+    memcpy(blob + blob_len, payload, len);
+    blob_len += len;
+    card_bitmap(blob + blob_len, inverted);
+    blob_len += BITMAP_BYTES;
+    blob[4]++;
+}
+
+// Card A as extracted with the first `errors` cells from 200 on flipped,
+// cells in which A and B agree
+static void extracted(struct quirc_code *code, int errors) {
+    int i;
+    memset(code, 0, sizeof(*code));
+    code->size = SIZE;
+    card_bitmap(code->cell_bitmap, 0);
+    for (i = 200; i < 200 + errors; i++) {
+        set_cell(code->cell_bitmap, i, !get_cell(code->cell_bitmap, i));
+    }
+}
+
+static void test_load(void) {
+    blob_start();
+    blob_add(SIZE, "card-a", 0);
+    blob_add(SIZE, "card-b", 200);
+    assert(codebook_load(blob, blob_len) == 0);
+    assert(codebook_count() == 2);
+
+    // Truncated, bad magic, bad grid size: nothing stays loaded
+    assert(codebook_load(blob, blob_len - 1) == -1);
+    assert(codebook_count() == 0);
+    blob[0] = 'X';
+    assert(codebook_load(blob, blob_len) == -1);
+    blob[0] = CODEBOOK_MAGIC[0];
+    blob[6] = 22;
+    assert(codebook_load(blob, blob_len) == -1);
+    assert(codebook_load(NULL, 0) == -1);
+}
+
+static void test_nearest(void) {
+    struct quirc_code code;
+    char out[16];
+    int dist;
+
+    blob_start();
+    blob_add(SIZE, "card-b", 200);
+    blob_add(SIZE, "card-a", 0);
+    assert(codebook_load(blob, blob_len) == 0);
+
+    extracted(&code, 0);
+    assert(codebook_match(&code, out, sizeof(out), &dist) == 1);
+    assert(!strcmp(out, "card-a") && dist == 0);
+
+    // Nearest entry wins, whatever its position in the blob
+    code.cell_bitmap[0] ^= 0xff;
+    assert(codebook_match(&code, out, sizeof(out), &dist) == 1);
+    assert(!strcmp(out, "card-a") && dist == 8);
+
+    card_bitmap(code.cell_bitmap, 195);
+    assert(codebook_match(&code, out, sizeof(out), &dist) == 1);
+    assert(!strcmp(out, "card-b") && dist == 5);
+
+    // Payload that does not fit, with its terminator, is not a match
+    extracted(&code, 0);
+    assert(codebook_match(&code, out, 6, &dist) == 0);
+    assert(codebook_match(&code, out, 7, NULL) == 1);
+}
+
+static void test_threshold(void) {
+    struct quirc_code code;
+    char out[16];
+    int dist;
+
+    blob_start();
+    blob_add(SIZE, "card-a", 0);
+    blob_add(SIZE, "card-b", 200);
+    assert(codebook_load(blob, blob_len) == 0);
+
+    // Up to 15% of the cells wrong is still card A...
+    extracted(&code, 66);
+    assert(codebook_match(&code, out, sizeof(out), &dist) == 1);
+    assert(!strcmp(out, "card-a") && dist == 66);
+
+    // ...one more is left to the full decoder, with the distance reported
+    extracted(&code, 67);
+    out[0] = 0;
+    assert(codebook_match(&code, out, sizeof(out), &dist) == 0);
+    assert(dist == 67 && out[0] == 0);
+
+    // Other grid sizes are not compared at all
+    extracted(&code, 0);
+    code.size = 25;
+    assert(codebook_match(&code, out, sizeof(out), &dist) == 0);
+    assert(dist == -1);
+}
+
+static void test_margin(void) {
+    struct quirc_code code;
+    char out[16];
+    int dist;
+
+    // C is 44 cells from A: too close to tell apart from an exact read
+    blob_start();
+    blob_add(SIZE, "card-a", 0);
+    blob_add(SIZE, "card-c", 44);
+    assert(codebook_load(blob, blob_len) == 0);
+    extracted(&code, 0);
+    assert(codebook_match(&code, out, sizeof(out), &dist) == 0);
+    assert(dist == 0);
+
+    // 45 cells is enough
+    blob_start();
+    blob_add(SIZE, "card-a", 0);
+    blob_add(SIZE, "card-c", 45);
+    assert(codebook_load(blob, blob_len) == 0);
+    assert(codebook_match(&code, out, sizeof(out), &dist) == 1);
+    assert(!strcmp(out, "card-a"));
+}
+
+static void test_empty(void) {
+    struct quirc_code code;
+    char out[16];
+    int dist;
+
+    blob_start();
+    assert(codebook_load(blob, blob_len) == 0);
+    extracted(&code, 0);
+    assert(codebook_match(&code, out, sizeof(out), &dist) == 0);
+    assert(dist == -1);
+}
+
+int main(void) {
+    test_load();
+    test_nearest();
+    test_threshold();
+    test_margin();
+    test_empty();
+    printf("test_codebook: ok\n");
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// correct_format is static
+#include "../decode.c"
+
+#define TRIALS 200000
+
+// value with n distinct bits of 15 flipped
+static uint16_t flip(uint16_t value, int n) {
+    uint16_t flipped = 0;
+    while (n) {
+        uint16_t bit = 1 << (rand() % 15);
+        if (!(flipped & bit)) {
+            flipped |= bit;
+            n--;
+        }
+    }
+    return value ^ flipped;
+}
+
+// A word more than 3 bits from every codeword
+static uint16_t unreadable(void) {
+    for (;;) {
+        uint16_t u = rand() & 0x7fff;
+        int i;
+        for (i = 0; i < FORMAT_CODEWORDS; i++) {
+            if (__builtin_popcount(format_codewords[i] ^ u) <= FORMAT_MAX_ERROR) {
+                break;
+            }
+        }
+        if (i == FORMAT_CODEWORDS) {
+            return u;
+        }
+    }
+}
+
+static void test_clean(void) {
+    int i, dist;
+    for (i = 0; i < FORMAT_CODEWORDS; i++) {
+        uint16_t c = format_codewords[i];
+        assert(correct_format(c, c, &dist) == i && dist == 0);
+    }
+}
+
+static void test_both_readable(void) {
+    int t, dist;
+    for (t = 0; t < TRIALS; t++) {
+        int i = rand() % FORMAT_CODEWORDS;
+        int e0 = rand() % 4, e1 = rand() % 4;
+        uint16_t c = format_codewords[i];
+        assert(correct_format(flip(c, e0), flip(c, e1), &dist) == i);
+        assert(dist == e0 + e1);
+    }
+}
+
+// One copy within 3 bits, the other anything at all: the readable copy
+// decides, as in upstream quirc
+static void test_one_readable(void) {
+    int t, dist;
+    for (t = 0; t < TRIALS; t++) {
+        int i = rand() % FORMAT_CODEWORDS;
+        uint16_t good = flip(format_codewords[i], rand() % 4);
+        assert(correct_format(good, rand() & 0x7fff, &dist) == i);
+        assert(correct_format(unreadable(), good, &dist) == i);
+    }
+}
+
+static void test_unreadable(void) {
+    int t, dist;
+    for (t = 0; t < 1000; t++) {
+        assert(correct_format(unreadable(), unreadable(), &dist) == -1);
+    }
+}
+
+int main(void) {
+    srand(1);
+    test_clean();
+    test_both_readable();
+    test_one_readable();
+    test_unreadable();
+    printf("test_format: ok\n");
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "qrcamera.h"
+#include "qrpresence.h"
+
+// Drives qrpresence through the file camera. The frames are written at
+// run time from the fixtures of make_frames.py: the empty table, the
+// table with a card, and the empty table under brighter ambient light.
+
+#define SEQUENCE_DIR "build/presence"
+#define FRAME_PATTERN SEQUENCE_DIR "/frame%04d.pgm"
+
+// The preview is captured without flash, which the file camera models
+// as a quarter of the recorded levels
+#define PREVIEW_LEVELS 4
+
+// Polls for the baseline to settle after an ambient change
+#define SETTLE_POLLS 40
+
+typedef struct {
+    int width;
+    int height;
+    uint8_t *buf;
+} image_t;
+
+static int frames;
+
+static void load(const char *path, image_t *img) {
+    FILE *f = fopen(path, "rb");
+    assert(f);
+    assert(fscanf(f, "P5 %d %d 255", &img->width, &img->height) == 2);
+    fgetc(f);
+    img->buf = malloc(img->width * img->height);
+    assert(fread(img->buf, 1, img->width * img->height, f) ==
+           (size_t)(img->width * img->height));
+    fclose(f);
+}
+
+// Append img to the sequence, with offset added to every level
+static void add_frame(const image_t *img, int offset) {
+    char path[64];
+    FILE *f;
+    int i;
+
+    snprintf(path, sizeof(path), FRAME_PATTERN, frames++);
+    f = fopen(path, "wb");
+    assert(f);
+    fprintf(f, "P5\n%d %d\n255\n", img->width, img->height);
+    for (i = 0; i < img->width * img->height; i++) {
+        int v = img->buf[i] + offset;
+        fputc(v > 255 ? 255 : v, f);
+    }
+    fclose(f);
+}
+
+static int poll(void) {
+    qrpresence_metrics_t metrics;
+    int present = qrpresence_poll(&metrics);
+    assert(metrics.present == present);
+    return present;
+}
+
+int main(void) {
+    image_t empty, card;
+    char path[64];
+    int i;
+
+    load("frames/frame0002.pgm", &empty);
+    load("frames/frame0000.pgm", &card);
+    mkdir(SEQUENCE_DIR, 0755);
+
+    // Calibration
+    add_frame(&empty, 0);
+    add_frame(&empty, 0);
+    add_frame(&empty, 0);
+    // A card comes and goes
+    add_frame(&empty, 0);
+    add_frame(&card, 0);
+    add_frame(&card, 0);
+    add_frame(&empty, 0);
+    // Ambient light 7 preview levels brighter, too little to notice and
+    // less than the baseline's adaptation divisor
+    for (i = 0; i < SETTLE_POLLS; i++) {
+        add_frame(&empty, 7 * PREVIEW_LEVELS);
+    }
+    // Another 20 levels: below the brightness threshold from where the
+    // baseline has settled, above it from the calibrated one
+    add_frame(&empty, 27 * PREVIEW_LEVELS);
+    // Wrap around here, not at a longer sequence of an earlier run
+    snprintf(path, sizeof(path), FRAME_PATTERN, frames);
+    unlink(path);
+
+    assert(qrcamera_setup() == ESP_OK);
+    assert(qrpresence_calibrate() == ESP_OK);
+
+    assert(poll() == 0);
+    assert(poll() == 1);
+    assert(poll() == 1);
+    assert(poll() == 0);
+    for (i = 0; i < SETTLE_POLLS; i++) {
+        assert(poll() == 0);
+    }
+    assert(poll() == 0);
+
+    free(empty.buf);
+    free(card.buf);
+    printf("test_presence: ok\n");
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "qrcamera.h"
+
+// Replays the frames written by make_frames.py through the file camera
+// and the full qrcamera_get path
+
+static const char *expected[] = {
+    "tgbl:card-0001",
+    "tgbl:card-0002",
+    NULL,   // empty table
+    "https://example.org/tgbl/c/42",
+};
+
+#define FRAMES (sizeof(expected) / sizeof(expected[0]))
+
+static void test_payloads(void) {
+    char out[64];
+    size_t i;
+    int lap;
+
+    // Twice round, the file camera wraps at the first missing frame
+    for (lap = 0; lap < 2; lap++) {
+        for (i = 0; i < FRAMES; i++) {
+            int result = qrcamera_get(out, sizeof(out));
+            if (expected[i]) {
+                assert(result == 1);
+                assert(strcmp(out, expected[i]) == 0);
+            } else {
+                assert(result == 0);
+            }
+        }
+    }
+}
+
+static void test_diag(void) {
+    qrcamera_diag_t diag;
+    char out[64];
+
+    // Frame 0 again, after the second lap
+    assert(qrcamera_get(out, sizeof(out)) == 1);
+    qrcamera_get_diag(&diag);
+    assert(diag.result == 1 && diag.codes == 1);
+    assert(diag.format_distance == 0 && diag.ecc_total == 0);
+    assert(diag.flash_on_at_us > 0);
+    assert(diag.flash_on_at_us <= diag.frame_at_us);
+    assert(diag.frame_at_us <= diag.decoded_at_us);
+}
+
+static void test_stats(void) {
+    qrcamera_stats_t stats;
+
+    qrcamera_get_stats(&stats);
+    assert(stats.reads == 2 * FRAMES + 1);
+    assert(stats.decoded == 2 * (FRAMES - 1) + 1);
+    assert(stats.no_code == 2);
+    assert(stats.no_frame == 0 && stats.decode_failed == 0);
+}
+
+static void set_frame_cache(bool on) {
+    qrcamera_settings_t settings;
+
+    qrcamera_get_settings(&settings);
+    settings.frame_cache = on;
+    assert(qrcamera_set_settings(&settings) == ESP_OK);
+}
+
+static void read_expect(size_t frame) {
+    char out[64];
+
+    assert(qrcamera_get(out, sizeof(out)) == (expected[frame] ? 1 : 0));
+    if (expected[frame]) {
+        assert(strcmp(out, expected[frame]) == 0);
+    }
+}
+
+// Reads with the cache off must not leave a payload paired with the
+// signature of an older frame
+static void test_cache_off(void) {
+    qrcamera_diag_t diag;
+
+    // Next up is frame 1
+    read_expect(1);
+    set_frame_cache(false);
+    read_expect(2);
+    read_expect(3);
+    read_expect(0);
+    set_frame_cache(true);
+    read_expect(1);
+    qrcamera_get_diag(&diag);
+    assert(diag.cached == 0);
+}
+
+int main(void) {
+    assert(qrcamera_setup() == ESP_OK);
+    test_payloads();
+    test_diag();
+    test_stats();
+    test_cache_off();
+    printf("test_replay: ok\n");
+    return 0;
+}
@@ -175,7 +175,7 @@ static void flood_fill_seed(struct quirc *q, int x, int y, int from, int to,
  * Adaptive thresholding
  */
 
-static uint8_t otsu(const struct quirc *q)
+static uint8_t otsu(const struct quirc *q, struct quirc_exposure *exp)
 {
 	int numPixels = q->w * q->h;
 
@@ -201,6 +201,7 @@ static uint8_t otsu(const struct quirc *q)
 	int q1 = 0;
 	double max = 0;
 	uint8_t threshold = 0;
+	(void)memset(exp, 0, sizeof(*exp));
 	for (i = 0; i <= UINT8_MAX; ++i) {
 		// Weighted background
 		q1 += histogram[i];
@@ -220,9 +221,17 @@ static uint8_t otsu(const struct quirc *q)
 		if (variance >= max) {
 			threshold = i;
 			max = variance;
+			exp->dark_mean = (int)m1;
+			exp->light_mean = (int)m2;
 		}
 	}
 
+	if (numPixels) {
+		exp->mean = sum / numPixels;
+		exp->clipped_low = histogram[0] * 1000 / numPixels;
+		exp->clipped_high = histogram[UINT8_MAX] * 1000 / numPixels;
+	}
+	exp->threshold = threshold;
 	return threshold;
 }
 
@@ -664,6 +673,113 @@ static int measure_timing_pattern(struct quirc *q, int index)
 	return 0;
 }
 
+/************************************************************************
+ * Version information
+ *
+ * Version 7+ codes carry the version number in two 18-bit BCH(18,6)
+ * blocks next to the top-right and bottom-left capstones. Indexed by
+ * version - 7.
+ */
+
+#define VERSION_INFO_MIN	7
+#define VERSION_INFO_MAX_ERROR	3
+#define VERSION_INFO_BITS	18
+
+static const uint32_t version_codewords[40 - VERSION_INFO_MIN + 1] = {
+	0x07c94, 0x085bc, 0x09a99, 0x0a4d3, 0x0bbf6, 0x0c762,
+	0x0d847, 0x0e60d, 0x0f928, 0x10b78, 0x1145d, 0x12a17,
+	0x13532, 0x149a6, 0x15683, 0x168c9, 0x177ec, 0x18ec4,
+	0x191e1, 0x1afab, 0x1b08e, 0x1cc1a, 0x1d33f, 0x1ed75,
+	0x1f250, 0x209d5, 0x216f0, 0x228ba, 0x2379f, 0x24b0b,
+	0x2542e, 0x26a64, 0x27541, 0x28c69
+};
+
+/* Read a cell relative to a capstone, using the capstone's own 7x7
+ * perspective transform. Unlike read_cell(), this does not depend on the
+ * grid size being right.
+ */
+static int read_capstone_cell(const struct quirc *q,
+			      const struct quirc_capstone *cap, int u, int v)
+{
+	struct quirc_point p;
+
+	perspective_map(cap->c, u + 0.5, v + 0.5, &p);
+	if (p.y < 0 || p.y >= q->h || p.x < 0 || p.x >= q->w)
+		return 0;
+
+	return q->pixels[p.y * q->w + p.x] ? 1 : 0;
+}
+
+/* Read both version information blocks and return the version they
+ * encode, or -1 if neither is readable. Bit i of the top-right block sits
+ * at grid (size - 11 + i % 3, i / 3), and the bottom-left block is its
+ * transpose. Both are read relative to their nearest capstone.
+ */
+static int read_version_info(const struct quirc *q, int index)
+{
+	const struct quirc_grid *qr = &q->grids[index];
+	const struct quirc_capstone *tr = &q->capstones[qr->caps[2]];
+	const struct quirc_capstone *bl = &q->capstones[qr->caps[0]];
+	uint32_t v0 = 0;
+	uint32_t v1 = 0;
+	int estimate = (qr->grid_size - 17) / 4;
+	int best = -1;
+	int best_dist = 0;
+	int best_single = 0;
+	int i;
+
+	for (i = VERSION_INFO_BITS - 1; i >= 0; i--) {
+		v0 = (v0 << 1) | read_capstone_cell(q, tr, i % 3 - 4, i / 3);
+		v1 = (v1 << 1) | read_capstone_cell(q, bl, i / 3, i % 3 - 4);
+	}
+
+	for (i = 0; i < (int)(sizeof(version_codewords) /
+			      sizeof(version_codewords[0])); i++) {
+		const uint32_t c = version_codewords[i];
+		const int d0 = __builtin_popcount(c ^ v0);
+		const int d1 = __builtin_popcount(c ^ v1);
+
+		if (best < 0 || d0 + d1 < best_dist) {
+			best = i;
+			best_dist = d0 + d1;
+			best_single = d0 < d1 ? d0 : d1;
+		}
+	}
+
+	if (best_dist <= VERSION_INFO_MAX_ERROR * 2)
+		return best + VERSION_INFO_MIN;
+
+	/* A single clean block is only trusted if timing already says the
+	 * code is large enough to have one; on smaller codes these cells
+	 * hold data and could match by chance.
+	 */
+	if (estimate >= VERSION_INFO_MIN &&
+	    best_single <= VERSION_INFO_MAX_ERROR)
+		return best + VERSION_INFO_MIN;
+
+	return -1;
+}
+
+/* The timing scan rounds to the nearest grid size, and on large codes a
+ * single missed transition gives the wrong version. Where the code is
+ * large enough to carry version information, let it override the
+ * estimate before we build the grid perspective.
+ */
+static void check_version_info(struct quirc *q, int index)
+{
+	struct quirc_grid *qr = &q->grids[index];
+	int ver;
+
+	if ((qr->grid_size - 17) / 4 < VERSION_INFO_MIN - 1)
+		return;
+
+	ver = read_version_info(q, index);
+	if (ver < 0 || ver > QUIRC_MAX_VERSION)
+		return;
+
+	qr->grid_size = ver * 4 + 17;
+}
+
 /* Read a cell from a grid using the currently set perspective
  * transform. Returns +/- 1 for black/white, 0 for cells which are
  * out of image bounds.
@@ -822,6 +938,8 @@ static void jiggle_perspective(struct quirc *q, int index)
 		for (i = 0; i < 8; i++)
 			adjustments[i] *= 0.5;
 	}
+
+	qr->fitness = best;
 }
 
 /* Once the capstones are in place and an alignment point has been
@@ -931,6 +1049,9 @@ static void record_qr_grid(struct quirc *q, int a, int b, int c)
 	if (measure_timing_pattern(q, qr_index) < 0)
 		goto fail;
 
+	/* Pin the grid size from the version information blocks, if any */
+	check_version_info(q, qr_index);
+
 	/* Make an estimate based for the alignment pattern based on extending
 	 * lines from capstones A and C.
 	 */
@@ -1102,12 +1223,15 @@ uint8_t *quirc_begin(struct quirc *q, int *w, int *h)
 	return q->image;
 }
 
-void quirc_end(struct quirc *q)
+void quirc_threshold(struct quirc *q)
 {
-	int i;
-
-	uint8_t threshold = otsu(q);
+	uint8_t threshold = otsu(q, &q->exposure);
 	pixels_setup(q, threshold);
+}
+
+void quirc_identify(struct quirc *q)
+{
+	int i;
 
 	for (i = 0; i < q->h; i++)
 		finder_scan(q, i);
@@ -1116,8 +1240,20 @@ void quirc_end(struct quirc *q)
 		test_grouping(q, i);
 }
 
+void quirc_end(struct quirc *q)
+{
+	quirc_threshold(q);
+	quirc_identify(q);
+}
+
 void quirc_extract(const struct quirc *q, int index,
 		   struct quirc_code *code)
+{
+	quirc_extract_diag(q, index, code, NULL);
+}
+
+void quirc_extract_diag(const struct quirc *q, int index,
+			struct quirc_code *code, struct quirc_diag *diag)
 {
 	const struct quirc_grid *qr = &q->grids[index];
 	int y;
@@ -1136,6 +1272,12 @@ void quirc_extract(const struct quirc *q, int index,
 
 	code->size = qr->grid_size;
 
+	if (diag) {
+		diag->fitness = qr->fitness;
+		diag->contrast = q->exposure.light_mean -
+			q->exposure.dark_mean;
+	}
+
 	for (y = 0; y < qr->grid_size; y++) {
 		int x;
 		for (x = 0; x < qr->grid_size; x++) {
@@ -1,15 +1,160 @@
 #ifndef __TANGIBLE_QRCAMERA_H__
 #define __TANGIBLE_QRCAMERA_H__
 
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
 #include "esp_err.h"
+#include "sdkconfig.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Why the quality gate rejected a frame, see CONFIG_QRCAMERA_GATE
+typedef enum {
+    QRCAMERA_GATE_PASS = 0,
+    QRCAMERA_GATE_CLIPPED,
+    QRCAMERA_GATE_LOW_CONTRAST,
+    QRCAMERA_GATE_BLURRED,
+    QRCAMERA_GATE_NO_FINDER,
+} qrcamera_gate_t;
+
+// Quality metrics and stage timing of a single read.
+// Fields not reached by the read are -1 (or 0 for the timings).
+typedef struct {
+    int result;             // qrcamera_get return value; for
+                            // qrcamera_get_all 1 if any code decoded
+    int cached;             // same scene as the last decoded frame, payload reused
+    int codes;              // codes found in the frame
+    int flash_percent;      // flash drive for the capture
+    int flash_lead_ms;      // flash on before capture
+    int brightness;         // mean grey level of the frame
+    qrcamera_gate_t gate;   // quality gate verdict
+    int sharpness;          // share of sharp edges, 1/1000
+    int finder_rows;        // sampled rows crossing a finder pattern
+    int fitness;            // grid perspective fitness score
+    int contrast;           // grey-level gap between dark and light
+    int codebook_distance;  // bit errors of the best codebook entry
+    int format_distance;    // format information bit errors
+    int ecc_blocks;         // Reed-Solomon blocks in the code
+    int ecc_capacity;       // correctable bytes per block
+    int ecc_worst;          // most bytes corrected in a single block
+    int ecc_total;          // bytes corrected over all blocks
+    uint32_t capture_us;    // flash on until frame received
+    uint32_t cache_us;      // frame signature and comparison
+    uint32_t gate_us;       // quality gate
+    uint32_t identify_us;   // threshold and finder pattern search
+    uint32_t extract_us;
+    uint32_t decode_us;     // codebook match and/or full decode
+    // When the read reached each stage, esp_timer_get_time(); 0 if not
+    int64_t flash_on_at_us;
+    int64_t frame_at_us;        // frame received
+    int64_t threshold_at_us;    // frame binarized
+    int64_t identify_at_us;     // finder pattern search done
+    int64_t decoded_at_us;      // payload known, decoded or from the cache
+} qrcamera_diag_t;
+
+// Largest payload per code returned by qrcamera_get_all
+#define QRCAMERA_CODE_PAYLOAD_SIZE 128
+
+typedef struct {
+    int x;
+    int y;
+} qrcamera_point_t;
+
+// One code of a batch read
+typedef struct {
+    int status;                     // 1: decoded, -10/-20 as qrcamera_get
+    qrcamera_point_t corners[4];    // top left first, clockwise, full-frame pixels
+    char payload[QRCAMERA_CODE_PAYLOAD_SIZE];   // empty unless decoded
+} qrcamera_code_t;
+
+// Running totals over all reads since qrcamera_setup
+typedef struct {
+    uint32_t reads;
+    uint32_t decoded;           // result 1
+    uint32_t codebook_hits;     // decoded via the codebook
+    uint32_t cache_hits;        // unchanged frame, previous payload reused
+    uint32_t no_frame;          // result -2
+    uint32_t no_code;           // result 0
+    uint32_t gated;             // result -3
+    uint32_t decode_failed;     // result -10, -20
+    uint32_t format_distance_sum;   // over full decodes
+    uint32_t ecc_worst_max;     // highest ecc_worst seen
+    uint32_t ecc_total_sum;
+    uint64_t capture_us_sum;
+    uint64_t cache_us_sum;
+    uint64_t gate_us_sum;
+    uint64_t identify_us_sum;
+    uint64_t extract_us_sum;
+    uint64_t decode_us_sum;
+} qrcamera_stats_t;
+
+// Settings that can be changed at run time, e.g. from the server.
+// Features not enabled in the configuration are always off.
+typedef struct {
+    bool gate;              // quality gate, CONFIG_QRCAMERA_GATE
+    bool roi;               // region of interest tracking, CONFIG_QRCAMERA_ROI
+    bool frame_cache;       // CONFIG_QRCAMERA_FRAME_CACHE
+    int flash_percent;      // fixed flash drive, -1: exposure control (or full)
+    int flash_lead_ms;      // fixed flash lead time, -1: exposure control
+                            // (or CONFIG_QRCAMERA_FLASH_LEAD_MS)
+} qrcamera_settings_t;
+
+// Longest flash lead time accepted by qrcamera_set_settings
+#define QRCAMERA_FLASH_LEAD_LIMIT_MS 1000
+
+// Receives a frame from qrcamera_dump_frame: width * height grey levels,
+// valid only during the call
+typedef void (*qrcamera_frame_sink_t)(const uint8_t *buf, int width, int height,
+                                      void *arg);
+
 esp_err_t qrcamera_setup();
 int qrcamera_get(char *out, size_t out_size);
 
+// Read every code of a single capture, e.g. several cards side by side.
+// Candidates sharing a finder pattern are reported once. Returns the
+// number of entries written to codes (at most max_codes; check each
+// status), or -2/-3 as qrcamera_get. The number of codes per frame is
+// limited by the decoder profile (QRCAMERA_MAX_GRIDS), and the sensor
+// window is reset to the full frame.
+int qrcamera_get_all(qrcamera_code_t *codes, int max_codes);
+
+// Optional codebook of known cards, see codebook.h for the blob layout.
+// qrcamera_setup loads the one embedded with CONFIG_QRCAMERA_CODEBOOK_FILE.
+// The blob is used in place and must stay valid (e.g. embedded in flash).
+esp_err_t qrcamera_set_codebook(const uint8_t *blob, size_t len);
+
+// Settings take effect from the next read; ESP_ERR_INVALID_ARG if a value
+// is out of range. Safe to call from any task.
+void qrcamera_get_settings(qrcamera_settings_t *settings);
+esp_err_t qrcamera_set_settings(const qrcamera_settings_t *settings);
+
+// Capture a frame as for a read and hand it to sink, to see what the
+// camera sees. Not while the pipeline runs.
+esp_err_t qrcamera_dump_frame(qrcamera_frame_sink_t sink, void *arg);
+
+// Diagnostics of the most recent qrcamera_get
+void qrcamera_get_diag(qrcamera_diag_t *diag);
+// Aggregated diagnostics; reset clears the totals. Safe to call from any
+// task, also while the pipeline runs.
+void qrcamera_get_stats(qrcamera_stats_t *stats);
+void qrcamera_reset_stats(void);
+
+#if CONFIG_QRCAMERA_PIPELINE
+// Largest payload returned by the pipeline
+#define QRCAMERA_PIPELINE_PAYLOAD_SIZE 128
+
+// Continuous capture on one core and decoding on the other, with the
+// flash on while running. Do not call qrcamera_get while it runs.
+esp_err_t qrcamera_pipeline_start(void);
+// Wait for the next successful decode; return values as qrcamera_get,
+// 0 on timeout
+int qrcamera_pipeline_get(char *out, size_t out_size, TickType_t timeout);
+void qrcamera_pipeline_stop(void);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,41 @@
+#ifndef __TANGIBLE_QRPRESENCE_H__
+#define __TANGIBLE_QRPRESENCE_H__
+
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Camera-based card presence detection, in place of the photo sensor.
+//
+// Between reads the camera runs a 160x120 preview of the full view without
+// flash. Each poll compares the preview against a baseline of the empty
+// view: overall brightness, the block-mean signature after removing the
+// brightness difference, and edge energy (a card, and a code in
+// particular, adds edges). While the view is empty the baseline slowly
+// follows ambient light. The next qrcamera_get switches back to full
+// resolution with flash.
+
+typedef struct {
+    bool present;
+    int brightness;     // mean grey level of the preview
+    int block_change;   // largest signature block difference to the baseline
+    int edge_gain;      // edge energy above the baseline, in percent
+} qrpresence_metrics_t;
+
+// Learn the empty view; there must be no card in view. qrcamera_setup must
+// have been called.
+esp_err_t qrpresence_calibrate(void);
+
+// Capture one preview frame. Returns 1 if a card is present, 0 if not, and
+// the previous state if no usable frame could be captured. metrics may be
+// NULL.
+int qrpresence_poll(qrpresence_metrics_t *metrics);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,59 @@
+#ifndef __TANGIBLE_QRSLOTS_H__
+#define __TANGIBLE_QRSLOTS_H__
+
+#include "esp_err.h"
+#include "qrcamera.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Slot layer for tables with several card slots in view of one camera.
+//
+// Each slot is a calibrated region of the frame with its own state. A scan
+// captures one frame, and only slots whose region changed since they were
+// last read are decoded, so the work per scan follows the number of slots
+// that changed rather than the number of cards on the table. Scans report
+// per-slot insert, remove and change events.
+
+// Region of the full sensor view, in full-frame pixels
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} qrslot_region_t;
+
+typedef enum {
+    QRSLOT_INSERTED,
+    QRSLOT_REMOVED,
+    QRSLOT_CHANGED,     // a different card in an occupied slot
+} qrslot_event_type_t;
+
+typedef struct {
+    int slot;
+    qrslot_event_type_t type;
+    char payload[QRCAMERA_CODE_PAYLOAD_SIZE];   // empty for QRSLOT_REMOVED
+} qrslot_event_t;
+
+// Set the slot regions (at most CONFIG_QRCAMERA_SLOTS_MAX) and forget all
+// slot state. qrcamera_setup must have been called.
+esp_err_t qrslots_configure(const qrslot_region_t *regions, int count);
+
+// Slots on a uniform cols x rows grid over the full view
+esp_err_t qrslots_configure_grid(int cols, int rows);
+
+// One slot per card currently in view, its region the bounding box of the
+// code grown by margin_percent on each side, ordered by rows then columns.
+// Returns the number of slots, or <0 as qrcamera_get_all.
+int qrslots_calibrate(int margin_percent);
+
+// Capture one frame and update the slots. Returns the number of events
+// written (at most max_events; slots beyond that are picked up by the next
+// scan), or -2 if no frame could be captured.
+int qrslots_scan(qrslot_event_t *events, int max_events);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,171 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "sdkconfig.h"
+
+#include "esp_log.h"
+
+#include "qrcamera_internal.h"
+#include "qrpresence.h"
+#include "signature.h"
+
+static const char *TAG = "qrpresence"; //for log
+
+#define PREVIEW_WIDTH 160
+#define PREVIEW_HEIGHT 120
+
+// Signature blocks of 10x10 preview pixels
+#define PRESENCE_SIG_COLS 16
+#define PRESENCE_SIG_ROWS 12
+#define PRESENCE_SIG_SIZE (PRESENCE_SIG_COLS * PRESENCE_SIG_ROWS)
+
+// Preview frames captured to calibrate; the first ones after switching
+// the sensor mode may still be settling
+#define CALIBRATE_FRAMES 3
+
+// An empty frame moves the baseline 1/n of the way towards itself
+#define BASELINE_ADAPT 8
+// The baseline is kept in 1/16 units, so that differences smaller than
+// BASELINE_ADAPT still move it
+#define BASELINE_SHIFT 4
+
+static bool calibrated;
+static bool present;
+static uint16_t baseline_fine[PRESENCE_SIG_SIZE];
+static uint8_t baseline[PRESENCE_SIG_SIZE];     // rounded baseline_fine
+static int base_brightness_fine;
+static int base_edges_fine;
+
+// Mean absolute horizontal plus vertical step over every other pixel of
+// every other row, in 1/16 grey levels
+static int edge_energy(const uint8_t *buf, int w, int h) {
+    unsigned int sum = 0;
+    unsigned int count = 0;
+    int x, y;
+
+    for (y = 0; y < h - 1; y += 2) {
+        const uint8_t *row = buf + y * w;
+        for (x = 0; x < w - 1; x += 2) {
+            sum += abs(row[x + 1] - row[x]) + abs(row[x + w] - row[x]);
+            count++;
+        }
+    }
+    return count ? sum * 16 / count : 0;
+}
+
+static int mean(const uint8_t *sig, int n) {
+    int sum = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        sum += sig[i];
+    }
+    return sum / n;
+}
+
+// Capture a preview frame and reduce it to signature, brightness and edge
+// energy
+static esp_err_t sample(uint8_t *sig, int *brightness, int *edges) {
+    camera_frame_t fb;
+
+    if (qrcamera_capture_preview(&fb, PREVIEW_WIDTH, PREVIEW_HEIGHT) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    if (fb.width != PREVIEW_WIDTH || fb.height != PREVIEW_HEIGHT) {
+        // Exposed before the switch to the preview
+        qrcamera_release_frame(&fb);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    signature_compute(fb.buf, fb.width, 0, 0, fb.width, fb.height,
+                      sig, PRESENCE_SIG_COLS, PRESENCE_SIG_ROWS);
+    *brightness = mean(sig, PRESENCE_SIG_SIZE);
+    *edges = edge_energy(fb.buf, fb.width, fb.height);
+    qrcamera_release_frame(&fb);
+    return ESP_OK;
+}
+
+// Move a fine baseline value 1/BASELINE_ADAPT of the way towards value
+static int adapt(int fine, int value) {
+    return fine + ((value << BASELINE_SHIFT) - fine) / BASELINE_ADAPT;
+}
+
+static int rounded(int fine) {
+    return (fine + (1 << (BASELINE_SHIFT - 1))) >> BASELINE_SHIFT;
+}
+
+esp_err_t qrpresence_calibrate(void) {
+    esp_err_t err = ESP_FAIL;
+    int brightness, edges;
+    int i;
+
+    for (i = 0; i < CALIBRATE_FRAMES; i++) {
+        if (sample(baseline, &brightness, &edges) == ESP_OK) {
+            err = ESP_OK;
+        }
+    }
+    calibrated = err == ESP_OK;
+    present = false;
+    if (calibrated) {
+        for (i = 0; i < PRESENCE_SIG_SIZE; i++) {
+            baseline_fine[i] = baseline[i] << BASELINE_SHIFT;
+        }
+        base_brightness_fine = brightness << BASELINE_SHIFT;
+        base_edges_fine = edges << BASELINE_SHIFT;
+        ESP_LOGI(TAG, "Empty view: brightness %d, edges %d", brightness, edges);
+    } else {
+        ESP_LOGE(TAG, "No preview frame to calibrate from");
+    }
+    return err;
+}
+
+int qrpresence_poll(qrpresence_metrics_t *metrics) {
+    uint8_t sig[PRESENCE_SIG_SIZE];
+    qrpresence_metrics_t m;
+    int edges;
+    int i;
+
+    if (!calibrated && qrpresence_calibrate() != ESP_OK) {
+        return present;
+    }
+    if (sample(sig, &m.brightness, &edges) != ESP_OK) {
+        ESP_LOGI(TAG, "No preview frame");
+        return present;
+    }
+
+    int base_edges = rounded(base_edges_fine);
+    signature_distance(sig, baseline, PRESENCE_SIG_SIZE, &m.block_change);
+    // Offset by one grey level, so that a featureless empty view does not
+    // make every bit of noise a large relative gain
+    m.edge_gain = (edges - base_edges) * 100 / (base_edges + 16);
+    int brightness_change = abs(m.brightness - rounded(base_brightness_fine));
+
+    // Arrival on any one measure; leaving needs all of them well back
+    // below, so that the state does not flicker at the thresholds
+    if (!present) {
+        present = m.block_change > CONFIG_QRCAMERA_PRESENCE_BLOCK_THRESHOLD ||
+                  brightness_change > CONFIG_QRCAMERA_PRESENCE_BRIGHTNESS_THRESHOLD ||
+                  m.edge_gain > CONFIG_QRCAMERA_PRESENCE_EDGE_PERCENT;
+    } else {
+        present = m.block_change > CONFIG_QRCAMERA_PRESENCE_BLOCK_THRESHOLD / 2 ||
+                  brightness_change > CONFIG_QRCAMERA_PRESENCE_BRIGHTNESS_THRESHOLD / 2 ||
+                  m.edge_gain > CONFIG_QRCAMERA_PRESENCE_EDGE_PERCENT / 2;
+    }
+
+    if (!present) {
+        // Follow slow changes of ambient light
+        for (i = 0; i < PRESENCE_SIG_SIZE; i++) {
+            baseline_fine[i] = adapt(baseline_fine[i], sig[i]);
+            baseline[i] = rounded(baseline_fine[i]);
+        }
+        base_brightness_fine = adapt(base_brightness_fine, m.brightness);
+        base_edges_fine = adapt(base_edges_fine, edges);
+    }
+
+    m.present = present;
+    ESP_LOGI(TAG, "Present %d: brightness %d, block change %d, edge gain %d%%",
+             m.present, m.brightness, m.block_change, m.edge_gain);
+    if (metrics) {
+        *metrics = m;
+    }
+    return present;
+}
@@ -1,74 +1,79 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include <limits.h>
+#include <stdlib.h> // for abs
 #include <string.h> // for memset
 
+#include "sdkconfig.h"
+
 #include "esp_log.h"
 #include "esp_system.h"
-#include "esp_camera.h"
+#include "esp_timer.h"
 
 #include "quirc.h"
 #include "quirc_internal.h"
+#include "codebook.h"
+#include "exposure.h"
+#include "framegate.h"
+#include "signature.h"
+#include "camera_source.h"
 #include "qrcamera.h"
-#include "driver/gpio.h"
+#include "qrcamera_internal.h"
 
-static camera_config_t camera_config;
 static struct quirc qr_recognizer;
 static struct quirc_data qr_data;
 static struct quirc_code qr_code;
+static struct quirc_diag qr_diag;
+static struct quirc_exposure frame_exposure;
+static qrcamera_diag_t last_diag;
+static qrcamera_stats_t stats;
+
+// See qrcamera_set_settings
+static qrcamera_settings_t settings = {
+#if CONFIG_QRCAMERA_GATE
+    .gate = true,
+#endif
+#if CONFIG_QRCAMERA_ROI
+    .roi = true,
+#endif
+#if CONFIG_QRCAMERA_FRAME_CACHE
+    .frame_cache = true,
+#endif
+    .flash_percent = -1,
+    .flash_lead_ms = -1,
+};
+// Guards settings, and stats, which the pipeline's decode task updates
+static portMUX_TYPE settings_lock = portMUX_INITIALIZER_UNLOCKED;
 
 static const char *TAG = "qrcamera"; //for log
 
-static const gpio_num_t flash_pin = GPIO_NUM_4;
-
-#define PWDN_GPIO_NUM     32
-#define RESET_GPIO_NUM    -1
-#define XCLK_GPIO_NUM      0
-#define SIOD_GPIO_NUM     26
-#define SIOC_GPIO_NUM     27
-#define Y9_GPIO_NUM       35
-#define Y8_GPIO_NUM       34
-#define Y7_GPIO_NUM       39
-#define Y6_GPIO_NUM       36
-#define Y5_GPIO_NUM       21
-#define Y4_GPIO_NUM       19
-#define Y3_GPIO_NUM       18
-#define Y2_GPIO_NUM        5
-#define VSYNC_GPIO_NUM    25
-#define HREF_GPIO_NUM     23
-#define PCLK_GPIO_NUM     22
-
-
-// packages/esp32/hardware/esp32/1.0.5/tools/sdk/include/esp32-camera/esp_camera.h
-// https://github.com/espressif/esp32-camera
-// https://github.com/espressif/esp32-camera/blob/master/driver/include/sensor.h
-
-esp_err_t setup_camera() {
-    camera_config.ledc_channel = LEDC_CHANNEL_0;
-    camera_config.ledc_timer = LEDC_TIMER_0;
-    camera_config.pin_d0 = Y2_GPIO_NUM;
-    camera_config.pin_d1 = Y3_GPIO_NUM;
-    camera_config.pin_d2 = Y4_GPIO_NUM;
-    camera_config.pin_d3 = Y5_GPIO_NUM;
-    camera_config.pin_d4 = Y6_GPIO_NUM;
-    camera_config.pin_d5 = Y7_GPIO_NUM;
-    camera_config.pin_d6 = Y8_GPIO_NUM;
-    camera_config.pin_d7 = Y9_GPIO_NUM;
-    camera_config.pin_xclk = XCLK_GPIO_NUM;
-    camera_config.pin_pclk = PCLK_GPIO_NUM;
-    camera_config.pin_vsync = VSYNC_GPIO_NUM;
-    camera_config.pin_href = HREF_GPIO_NUM;
-    camera_config.pin_sscb_sda = SIOD_GPIO_NUM;
-    camera_config.pin_sscb_scl = SIOC_GPIO_NUM;
-    camera_config.pin_pwdn = PWDN_GPIO_NUM;
-    camera_config.pin_reset = RESET_GPIO_NUM;
-    camera_config.xclk_freq_hz = 10000000;
-    camera_config.pixel_format = PIXFORMAT_GRAYSCALE; 
-    camera_config.frame_size = FRAMESIZE_VGA;  // set picture size, FRAMESIZE_VGA (640x480), see sensor.h
-    // camera_config.jpeg_quality = 15;           // quality of JPEG output. 0-63 lower means higher quality
-    camera_config.fb_count = 1;              // 1: Wait for V-Synch // 2: Continous Capture (Video)
-
-    return esp_camera_init(&camera_config);
-}
+#if CONFIG_QRCAMERA_SOURCE_FILE
+#define CAMERA_SOURCE camera_source_file
+#else
+#define CAMERA_SOURCE camera_source_esp32
+#endif
+
+#if CONFIG_QRCAMERA_PIPELINE
+// The camera, with sensor changes held back while the pipeline runs
+static const camera_source_t pipeline_source;
+static const camera_source_t *source = &pipeline_source;
+#else
+static const camera_source_t *source = &CAMERA_SOURCE;
+#endif
+
+#if CONFIG_QRCAMERA_PIPELINE
+// One frame being decoded, one queued and one for the driver to fill
+#define QRCAMERA_FB_COUNT 3
+#else
+#define QRCAMERA_FB_COUNT 1
+#endif
+
+#if QRCAMERA_CODEBOOK_EMBEDDED
+// CONFIG_QRCAMERA_CODEBOOK_FILE, embedded by CMakeLists.txt
+extern const uint8_t codebook_bin_start[] asm("_binary_codebook_bin_start");
+extern const uint8_t codebook_bin_end[] asm("_binary_codebook_bin_end");
+#endif
 
 static const char *data_type_str(int dt)
 {
@@ -104,77 +109,1025 @@ static void dump_data(const struct quirc_data *data)
 }
 
 
-int process_frame_buffer(camera_fb_t *fb, char *out, size_t out_size) {
-    quirc_analyze_buffer(&qr_recognizer, fb->buf, fb->width, fb->height);
+static void reset_diag(qrcamera_diag_t *diag) {
+    memset(diag, 0, sizeof(*diag));
+    diag->brightness = -1;
+    diag->sharpness = -1;
+    diag->finder_rows = -1;
+    diag->fitness = -1;
+    diag->contrast = -1;
+    diag->codebook_distance = -1;
+    diag->format_distance = -1;
+    diag->ecc_blocks = -1;
+    diag->ecc_capacity = -1;
+    diag->ecc_worst = -1;
+    diag->ecc_total = -1;
+}
+
+static void record_decode_diag(qrcamera_diag_t *diag, const struct quirc_diag *qd) {
+    int i;
+    diag->format_distance = qd->format_distance;
+    if (!qd->num_blocks) {
+        return;
+    }
+    diag->ecc_blocks = qd->num_blocks;
+    diag->ecc_capacity = qd->ecc_capacity;
+    diag->ecc_worst = 0;
+    diag->ecc_total = 0;
+    for (i = 0; i < qd->num_blocks; i++) {
+        if (qd->block_errors[i] > diag->ecc_worst) {
+            diag->ecc_worst = qd->block_errors[i];
+        }
+        diag->ecc_total += qd->block_errors[i];
+    }
+}
+
+static void update_stats(const qrcamera_diag_t *diag) {
+    portENTER_CRITICAL(&settings_lock);
+    stats.reads++;
+    switch (diag->result) {
+    case 1:
+        stats.decoded++;
+        if (diag->cached) {
+            stats.cache_hits++;
+        } else if (diag->format_distance < 0) {
+            stats.codebook_hits++;
+        } else {
+            stats.format_distance_sum += diag->format_distance;
+        }
+        break;
+    case 0:
+        stats.no_code++;
+        break;
+    case -2:
+        stats.no_frame++;
+        break;
+    case -3:
+        stats.gated++;
+        break;
+    default:
+        stats.decode_failed++;
+        break;
+    }
+    if (diag->ecc_worst > 0) {
+        if ((uint32_t)diag->ecc_worst > stats.ecc_worst_max) {
+            stats.ecc_worst_max = diag->ecc_worst;
+        }
+        stats.ecc_total_sum += diag->ecc_total;
+    }
+    stats.capture_us_sum += diag->capture_us;
+    stats.cache_us_sum += diag->cache_us;
+    stats.gate_us_sum += diag->gate_us;
+    stats.identify_us_sum += diag->identify_us;
+    stats.extract_us_sum += diag->extract_us;
+    stats.decode_us_sum += diag->decode_us;
+    portEXIT_CRITICAL(&settings_lock);
+}
+
+// Map a point of the frame to full-frame pixels
+static void frame_to_full(const camera_frame_t *fb, const struct quirc_point *p,
+                          int *x, int *y) {
+    const camera_window_t *w = &fb->window;
+    *x = w->x + p->x * w->width / (int)fb->width;
+    *y = w->y + p->y * w->height / (int)fb->height;
+}
+
+// Gate and identify.
+// >=0: number of candidate codes
+// -3: frame rejected by the quality gate
+static int identify_frame(camera_frame_t *fb, qrcamera_diag_t *diag) {
+    int64_t t0 = esp_timer_get_time();
+    int64_t t1;
+#if CONFIG_QRCAMERA_GATE
+    if (settings.gate) {
+        framegate_metrics_t gate_metrics;
+        diag->gate = framegate_check(fb->buf, fb->width, fb->height,
+                                     &frame_exposure, &gate_metrics);
+        diag->sharpness = gate_metrics.sharpness;
+        diag->finder_rows = gate_metrics.finder_rows;
+        diag->brightness = frame_exposure.mean;
+        t1 = esp_timer_get_time();
+        diag->gate_us = t1 - t0;
+        if (diag->gate != QRCAMERA_GATE_PASS) {
+            ESP_LOGI(TAG, "Frame rejected: %s", framegate_str(diag->gate));
+            return -3;
+        }
+        t0 = t1;
+    }
+#endif
+    quirc_load_buffer(&qr_recognizer, fb->buf, fb->width, fb->height);
+    quirc_threshold(&qr_recognizer);
+    diag->threshold_at_us = esp_timer_get_time();
+    quirc_identify(&qr_recognizer);
+    t1 = esp_timer_get_time();
+    diag->identify_at_us = t1;
+    diag->identify_us = t1 - t0;
+    quirc_get_exposure(&qr_recognizer, &frame_exposure);
+    diag->brightness = frame_exposure.mean;
  
     // Check number of qr codes    
     int count = quirc_count(&qr_recognizer);
+    diag->codes = count;
     ESP_LOGI(TAG, "Found %d qr codes", count);
-    if (count != 1) {
-        return 0;
+    return count;
+}
+
+// Extract and decode one identified code into qr_code and out.
+// Stage times add up over calls, the quality fields are those of this code.
+static int decode_code(int index, char *out, size_t out_size, qrcamera_diag_t *diag) {
+    int64_t t0 = esp_timer_get_time();
+    quirc_extract_diag(&qr_recognizer, index, &qr_code, &qr_diag);
+    int64_t t1 = esp_timer_get_time();
+    diag->extract_us += t1 - t0;
+    diag->fitness = qr_diag.fitness;
+    diag->contrast = qr_diag.contrast;
+
+    // Known cards: match the cell bitmap directly and skip decoding
+    int cb_dist;
+    int matched = codebook_match(&qr_code, out, out_size, &cb_dist);
+    diag->codebook_distance = cb_dist;
+    if (matched) {
+        diag->decoded_at_us = esp_timer_get_time();
+        diag->decode_us += diag->decoded_at_us - t1;
+        ESP_LOGI(TAG, "Codebook match: %s (distance %d)", out, cb_dist);
+        return 1;
     }
-    // Exactly one code: decode
-    quirc_extract(&qr_recognizer, 0, &qr_code); //0: index
- 
+
     ESP_LOGI(TAG, "Extract complete, decoding");
     //Decode a QR-code, returning the payload data.
-    quirc_decode_error_t err = quirc_decode(&qr_code, &qr_data);
+    quirc_decode_error_t err = quirc_decode_diag(&qr_code, &qr_data, &qr_diag);
+    diag->decode_us += esp_timer_get_time() - t1;
+    record_decode_diag(diag, &qr_diag);
     if (err) {
         ESP_LOGI(TAG, "Decoding FAILED: %s\n", quirc_strerror(err));
         return -10;
     }
     dump_data(&qr_data);
     if (qr_data.payload_len>=out_size) {
-        ESP_LOGI(TAG, "Oversize payload: %d > %d", out_size, qr_data.payload_len);
+        ESP_LOGI(TAG, "Oversize payload: %d > %d", (int)out_size, qr_data.payload_len);
         return -20;
     }
-    ESP_LOGI(TAG, "Successfully decoded unique QR");
     memcpy(out, qr_data.payload, qr_data.payload_len);
     out[qr_data.payload_len]=0;
+    diag->decoded_at_us = esp_timer_get_time();
     return 1;
 }
 
-void set_flash_state(bool onoff) {
-    gpio_set_level(flash_pin, onoff?1:0);
+int process_frame_buffer(camera_frame_t *fb, char *out, size_t out_size, qrcamera_diag_t *diag) {
+    int count = identify_frame(fb, diag);
+    if (count < 0) {
+        return count;
+    }
+    if (count != 1) {
+        return 0;
+    }
+    // Exactly one code: decode
+    int res = decode_code(0, out, out_size, diag); //0: index
+    if (res == 1) {
+        ESP_LOGI(TAG, "Successfully decoded unique QR");
+    }
+    return res;
+}
+
+// One finder pattern: the same capstone, or a finder that was detected
+// twice around (nearly) the same centre
+static bool same_finder(int a, int b) {
+    const struct quirc_capstone *ca = &qr_recognizer.capstones[a];
+    const struct quirc_capstone *cb = &qr_recognizer.capstones[b];
+    int size = abs(ca->corners[2].x - ca->corners[0].x) +
+               abs(ca->corners[2].y - ca->corners[0].y);
+    int dist = abs(ca->center.x - cb->center.x) + abs(ca->center.y - cb->center.y);
+    return a == b || dist * 4 < size;
+}
+
+static bool share_finder(int g1, int g2) {
+    const struct quirc_grid *a = &qr_recognizer.grids[g1];
+    const struct quirc_grid *b = &qr_recognizer.grids[g2];
+    int i, j;
+
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            if (same_finder(a->caps[i], b->caps[j])) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Candidates sharing a finder pattern are alternative groupings of the
+// same code; keep the best-fitting one of each. Returns the number of
+// grid indices written to selected.
+static int select_grids(int *selected) {
+    int count = quirc_count(&qr_recognizer);
+    int n = 0;
+    int i, j;
+
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < n; j++) {
+            if (share_finder(i, selected[j])) {
+                break;
+            }
+        }
+        if (j == n) {
+            selected[n++] = i;
+        } else if (qr_recognizer.grids[i].fitness >
+                   qr_recognizer.grids[selected[j]].fitness) {
+            selected[j] = i;
+        }
+    }
+    if (n < count) {
+        ESP_LOGI(TAG, "%d duplicate candidates dropped", count - n);
+    }
+    return n;
+}
+
+#if CONFIG_QRCAMERA_ROI
+/*
+ * Region of interest tracking
+ *
+ * Once a code has been read, the sensor is told to capture only the area
+ * around it, at the smallest standard frame size that still gives
+ * CONFIG_QRCAMERA_ROI_MIN_MODULE_PX pixels per module. This shrinks the
+ * capture time, DMA traffic and decoder working set together. Repeated
+ * failures widen back to the full frame.
+ *
+ * A source that cannot crop applies only the output size to the full view
+ * (see esp32_set_window). Once a frame shows that, the output size is
+ * chosen for the full view instead.
+ */
+
+#define ROI_MAX_FAILURES 2
+
+static const int roi_out_widths[] = {160, 320, 640};
+static bool roi_active;
+static bool roi_crops = true;
+static camera_window_t roi_requested;
+static int roi_failures;
+
+static int clamp(int v, int lo, int hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static void roi_widen(void) {
+    if (roi_active && source->set_window(NULL) == ESP_OK) {
+        roi_active = false;
+        ESP_LOGI(TAG, "ROI: back to full frame");
+    }
+}
+
+// qr_code must hold the code just read from fb
+static void roi_track(const camera_frame_t *fb) {
+    const camera_window_t *w = &fb->window;
+    camera_window_t next;
+    int full_w, full_h;
+    int x0 = INT_MAX, y0 = INT_MAX, x1 = INT_MIN, y1 = INT_MIN;
+    int i;
+
+    // Code bounding box in full-frame pixels
+    for (i = 0; i < 4; i++) {
+        int x, y;
+        frame_to_full(fb, &qr_code.corners[i], &x, &y);
+        x0 = x < x0 ? x : x0;
+        x1 = x > x1 ? x : x1;
+        y0 = y < y0 ? y : y0;
+        y1 = y > y1 ? y : y1;
+    }
+    int size = (x1 - x0) > (y1 - y0) ? (x1 - x0) : (y1 - y0);
+    if (size < qr_code.size) {
+        size = qr_code.size;
+    }
+
+    // Square around the code plus margin, widened to 4:3
+    source->get_full_size(&full_w, &full_h);
+    int half_h = size * (100 + 2 * CONFIG_QRCAMERA_ROI_MARGIN) / 200;
+    int half_w = half_h * 4 / 3;
+    if (half_w * 2 > full_w || half_h * 2 > full_h) {
+        roi_widen();
+        return;
+    }
+
+    // Smallest output that keeps enough pixels per module of the view
+    // actually captured
+    int span = roi_crops ? 2 * half_w : full_w;
+    int needed = span * CONFIG_QRCAMERA_ROI_MIN_MODULE_PX * qr_code.size / size;
+    for (i = 0; i < (int)(sizeof(roi_out_widths) / sizeof(roi_out_widths[0])) - 1; i++) {
+        if (roi_out_widths[i] >= needed) {
+            break;
+        }
+    }
+    next.out_width = roi_out_widths[i];
+    next.out_height = next.out_width * 3 / 4;
+
+    if (!roi_crops) {
+        // Only the output size changes
+        if (next.out_width >= full_w) {
+            roi_widen();
+            return;
+        }
+        next.x = 0;
+        next.y = 0;
+        next.width = full_w;
+        next.height = full_h;
+    } else {
+        // Never upscale: grow the window to the output size if needed
+        if (half_w * 2 < next.out_width) {
+            half_w = next.out_width / 2;
+            half_h = next.out_height / 2;
+        }
+        if (half_w * 2 >= full_w) {
+            roi_widen();
+            return;
+        }
+        next.width = half_w * 2;
+        next.height = half_h * 2;
+        next.x = clamp((x0 + x1) / 2 - half_w, 0, full_w - next.width) & ~3;
+        next.y = clamp((y0 + y1) / 2 - half_h, 0, full_h - next.height) & ~3;
+    }
+
+    // Keep the current window while the code stays well inside it
+    if (roi_active && w->out_width == next.out_width &&
+        x0 >= w->x && x1 <= w->x + w->width &&
+        y0 >= w->y && y1 <= w->y + w->height) {
+        return;
+    }
+    if (source->set_window(&next) == ESP_OK) {
+        roi_active = true;
+        roi_requested = next;
+    }
+}
+
+static void roi_update(const camera_frame_t *fb, int res) {
+    if (!settings.roi) {
+        // Switched off at run time
+        if (roi_active) {
+            roi_widen();
+        }
+        return;
+    }
+    // At the requested output size but not the requested region: the
+    // source only scaled the full view
+    if (roi_active && roi_crops &&
+        fb->window.out_width == roi_requested.out_width &&
+        (fb->window.width != roi_requested.width ||
+         fb->window.height != roi_requested.height)) {
+        roi_crops = false;
+        ESP_LOGI(TAG, "ROI: %s cannot crop, scaling the full view", CAMERA_SOURCE.name);
+    }
+    if (res == 1) {
+        roi_failures = 0;
+        roi_track(fb);
+    } else if (roi_active && ++roi_failures >= ROI_MAX_FAILURES) {
+        roi_failures = 0;
+        roi_widen();
+    }
 }
+#endif
+
+#if CONFIG_QRCAMERA_FRAME_CACHE
+/*
+ * Frame cache
+ *
+ * A 40x30 block-mean signature of the last decoded frame is kept with its
+ * payload. A new frame of the same window whose signature matches is
+ * taken to show the same card, and the cached payload is returned without
+ * identifying or decoding it.
+ */
 
-void setup_flash(void) {
-    gpio_reset_pin(flash_pin);
-    set_flash_state(false);
-    gpio_set_direction(flash_pin, GPIO_MODE_OUTPUT);
-    gpio_set_drive_capability(flash_pin, GPIO_DRIVE_CAP_0); //~10mA
-    set_flash_state(false);
+#define CACHE_COLS 40
+#define CACHE_ROWS 30
+
+static bool cache_valid;
+static camera_window_t cache_window;
+static uint8_t cache_signature[CACHE_COLS * CACHE_ROWS];
+static uint8_t frame_signature[CACHE_COLS * CACHE_ROWS];
+static bool frame_signature_fresh; // computed by the last cache_lookup
+static char cache_payload[QRCAMERA_CODE_PAYLOAD_SIZE];
+
+static bool same_window(const camera_window_t *a, const camera_window_t *b) {
+    return a->x == b->x && a->y == b->y && a->width == b->width &&
+           a->height == b->height && a->out_width == b->out_width;
+}
+
+// Must run before the frame is processed, which overwrites it
+static bool cache_lookup(const camera_frame_t *fb, char *out, size_t out_size,
+                         qrcamera_diag_t *diag) {
+    int64_t t0 = esp_timer_get_time();
+    int change;
+
+    frame_signature_fresh = false;
+    if (!settings.frame_cache) {
+        cache_valid = false;
+        return false;
+    }
+    signature_compute(fb->buf, fb->width, 0, 0, fb->width, fb->height,
+                      frame_signature, CACHE_COLS, CACHE_ROWS);
+    frame_signature_fresh = true;
+    if (cache_valid && same_window(&fb->window, &cache_window)) {
+        signature_distance(frame_signature, cache_signature,
+                           CACHE_COLS * CACHE_ROWS, &change);
+        if (change <= CONFIG_QRCAMERA_FRAME_CACHE_THRESHOLD &&
+            strlen(cache_payload) < out_size) {
+            strcpy(out, cache_payload);
+            diag->cached = 1;
+        }
+    }
+    diag->cache_us = esp_timer_get_time() - t0;
+    if (diag->cached) {
+        diag->decoded_at_us = t0 + diag->cache_us;
+        ESP_LOGI(TAG, "Unchanged frame, cached payload: %s", out);
+    }
+    return diag->cached;
+}
+
+// Remember the frame just looked up if it decoded, forget it otherwise.
+// Nothing to remember if the lookup skipped the signature (cache off).
+static void cache_store(const camera_frame_t *fb, int res, const char *payload) {
+    if (!frame_signature_fresh) {
+        return;
+    }
+    frame_signature_fresh = false;
+    cache_valid = res == 1 && strlen(payload) < sizeof(cache_payload);
+    if (cache_valid) {
+        memcpy(cache_signature, frame_signature, sizeof(cache_signature));
+        cache_window = fb->window;
+        strcpy(cache_payload, payload);
+    }
+}
+#else
+#define cache_lookup(fb, out, out_size, diag) false
+#define cache_store(fb, res, payload)
+#endif
+
+static void dump_diag(const qrcamera_diag_t *diag) {
+    ESP_LOGI(TAG, "Quality: fitness %d, contrast %d, format errors %d, ECC worst %d/%d over %d blocks",
+             diag->fitness, diag->contrast, diag->format_distance,
+             diag->ecc_worst, diag->ecc_capacity, diag->ecc_blocks);
+    ESP_LOGI(TAG, "Timing [us]: capture %u, cache %u, gate %u, identify %u, extract %u, decode %u",
+             (unsigned)diag->capture_us, (unsigned)diag->cache_us,
+             (unsigned)diag->gate_us, (unsigned)diag->identify_us,
+             (unsigned)diag->extract_us, (unsigned)diag->decode_us);
+    ESP_LOGI(TAG, "Lighting: flash %d%% for %d ms, brightness %d",
+             diag->flash_percent, diag->flash_lead_ms, diag->brightness);
+}
+
+// A fixed value in the settings overrides the controller
+#if CONFIG_QRCAMERA_EXPOSURE_CONTROL
+#define flash_percent() (settings.flash_percent >= 0 ? settings.flash_percent : \
+                         exposure_flash_percent())
+#define flash_lead_ms() (settings.flash_lead_ms >= 0 ? settings.flash_lead_ms : \
+                         exposure_lead_ms())
+
+// Feed the histogram of the frame just processed to the controller
+static bool update_exposure(int res, bool lead_timed) {
+    return exposure_update(&frame_exposure, res, lead_timed);
+}
+#else
+#define flash_percent() (settings.flash_percent >= 0 ? settings.flash_percent : 100)
+#define flash_lead_ms() (settings.flash_lead_ms >= 0 ? settings.flash_lead_ms : \
+                         CONFIG_QRCAMERA_FLASH_LEAD_MS)
+#endif
+
+// Whole ticks are slept, the remainder is spun, so that a learned lead
+// time shorter than a tick is not rounded down to nothing
+static void flash_lead_wait(int ms) {
+    int64_t until = esp_timer_get_time() + ms * 1000;
+    vTaskDelay(ms / portTICK_PERIOD_MS);
+    while (esp_timer_get_time() < until) {
+    }
 }
 
 esp_err_t qrcamera_setup() {
     memset(&qr_recognizer, 0, sizeof(qr_recognizer));
-    setup_flash();
-    return setup_camera();
+    ESP_LOGI(TAG, "Decoder profile: version <= %d, %d grids, %d bytes static",
+             QUIRC_MAX_VERSION, QUIRC_MAX_GRIDS,
+             (int)(sizeof(qr_recognizer) + sizeof(qr_data) + sizeof(qr_code)));
+    qrcamera_reset_stats();
+#if QRCAMERA_CODEBOOK_EMBEDDED
+    if (qrcamera_set_codebook(codebook_bin_start,
+                              codebook_bin_end - codebook_bin_start) != ESP_OK) {
+        ESP_LOGI(TAG, "Embedded codebook not loaded");
+    }
+#endif
+    ESP_LOGI(TAG, "Camera source: %s", CAMERA_SOURCE.name);
+    esp_err_t err = source->init(QRCAMERA_FB_COUNT);
+#if CONFIG_QRCAMERA_EXPOSURE_CONTROL
+    if (err == ESP_OK) {
+        err = exposure_init(source);
+    }
+#endif
+    return err;
+}
+
+esp_err_t qrcamera_set_codebook(const uint8_t *blob, size_t len) {
+    return codebook_load(blob, len) ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+void qrcamera_get_settings(qrcamera_settings_t *out) {
+    portENTER_CRITICAL(&settings_lock);
+    *out = settings;
+    portEXIT_CRITICAL(&settings_lock);
+}
+
+esp_err_t qrcamera_set_settings(const qrcamera_settings_t *in) {
+    if (in->flash_percent < -1 || in->flash_percent > 100 ||
+        in->flash_lead_ms < -1 || in->flash_lead_ms > QRCAMERA_FLASH_LEAD_LIMIT_MS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&settings_lock);
+    settings = *in;
+    // Features not built in stay off
+#if !CONFIG_QRCAMERA_GATE
+    settings.gate = false;
+#endif
+#if !CONFIG_QRCAMERA_ROI
+    settings.roi = false;
+#endif
+#if !CONFIG_QRCAMERA_FRAME_CACHE
+    settings.frame_cache = false;
+#endif
+    portEXIT_CRITICAL(&settings_lock);
+    ESP_LOGI(TAG, "Settings: gate %d, roi %d, frame cache %d, flash %d%%, lead %d ms",
+             settings.gate, settings.roi, settings.frame_cache,
+             settings.flash_percent, settings.flash_lead_ms);
+    return ESP_OK;
+}
+
+#if CONFIG_QRCAMERA_PRESENCE
+// The sensor is set up for the presence preview: low resolution, unlit
+static bool previewing;
+
+esp_err_t qrcamera_capture_preview(camera_frame_t *fb, int out_width, int out_height) {
+    if (!previewing) {
+        camera_window_t preview;
+        preview.x = 0;
+        preview.y = 0;
+        source->get_full_size(&preview.width, &preview.height);
+        preview.out_width = out_width;
+        preview.out_height = out_height;
+        if (source->set_window(&preview) != ESP_OK) {
+            ESP_LOGI(TAG, "Presence preview not supported");
+            return ESP_FAIL;
+        }
+#if CONFIG_QRCAMERA_ROI
+        roi_active = false;
+#endif
+        // No flash: let the sensor expose for ambient light
+        source->set_exposure(-1, 0);
+        previewing = true;
+    }
+    return source->get(fb);
+}
+
+// Back to capture settings; true if the sensor was in preview
+static bool preview_leave(void) {
+    if (!previewing) {
+        return false;
+    }
+    previewing = false;
+    source->set_window(NULL);
+#if CONFIG_QRCAMERA_EXPOSURE_CONTROL
+    exposure_restore();
+#endif
+    return true;
+}
+#else
+#define preview_leave() false
+#endif
+
+// Flash and capture one frame into fb, timed in last_diag
+esp_err_t qrcamera_capture_frame(camera_frame_t *fb) {
+    esp_err_t err;
+    bool from_preview = preview_leave();
+    dump_ram_state();
+    last_diag.flash_percent = flash_percent();
+    last_diag.flash_lead_ms = flash_lead_ms();
+    int64_t t0 = esp_timer_get_time();
+    last_diag.flash_on_at_us = t0;
+    source->set_flash(last_diag.flash_percent);
+    flash_lead_wait(last_diag.flash_lead_ms);
+    err = source->get(fb);
+    if (err == ESP_OK && from_preview && (int)fb->width != fb->window.out_width) {
+        // Still exposed at the preview size
+        source->put(fb);
+        err = source->get(fb);
+    }
+    last_diag.frame_at_us = esp_timer_get_time();
+    source->set_flash(0);
+    last_diag.capture_us = last_diag.frame_at_us - t0;
+    if (err != ESP_OK) {
+        ESP_LOGI(TAG, "Camera capture failed");
+    } else {
+        ESP_LOGI(TAG, "Camera capture success");
+        dump_ram_state();
+    }
+    return err;
+}
+
+esp_err_t qrcamera_dump_frame(qrcamera_frame_sink_t sink, void *arg) {
+    camera_frame_t fb;
+
+    if (qrcamera_capture_frame(&fb) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    sink(fb.buf, fb.width, fb.height, arg);
+    qrcamera_release_frame(&fb);
+    return ESP_OK;
+}
+
+void qrcamera_release_frame(camera_frame_t *fb) {
+    source->put(fb);
+    ESP_LOGI(TAG, "Frame buffer returned");
+    dump_ram_state();
+}
+
+void qrcamera_full_view(void) {
+#if CONFIG_QRCAMERA_ROI
+    roi_widen();
+#endif
+}
+
+void qrcamera_get_full_size(int *width, int *height) {
+    source->get_full_size(width, height);
 }
 
 // qr_recognizer must be initialized
 // <0: failure
 // -2: no framebuffer
+// -3: frame rejected by the quality gate, capture again
 // 0: ok, but no unique match
 // 1: exactly one match
 int qrcamera_get(char *out, size_t out_size) {
-    camera_fb_t *fb = NULL;
-    dump_ram_state();
-    set_flash_state(true);
-    vTaskDelay(10 / portTICK_PERIOD_MS);
-    fb = esp_camera_fb_get();
-    set_flash_state(false);
-    if (!fb) {
-        ESP_LOGI(TAG, "Camera capture failed");
-        return -2;
+    camera_frame_t fb;
+    int res;
+    reset_diag(&last_diag);
+    if (qrcamera_capture_frame(&fb) != ESP_OK) {
+        res = -2;
+    } else if (cache_lookup(&fb, out, out_size, &last_diag)) {
+        res = 1;
+        qrcamera_release_frame(&fb);
+    } else {
+        res = process_frame_buffer(&fb, out, out_size, &last_diag);
+        cache_store(&fb, res, out);
+#if CONFIG_QRCAMERA_ROI
+        roi_update(&fb, res);
+#endif
+#if CONFIG_QRCAMERA_EXPOSURE_CONTROL
+        update_exposure(res, true);
+#endif
+        qrcamera_release_frame(&fb);
     }
-    ESP_LOGI(TAG, "Camera capture success");
-    dump_ram_state();
-    int res = process_frame_buffer(fb, out, out_size);
 
-    esp_camera_fb_return(fb);
-    ESP_LOGI(TAG, "Frame buffer returned");
-    dump_ram_state();
+    last_diag.result = res;
+    update_stats(&last_diag);
+    dump_diag(&last_diag);
+    return res;
+}
 
+int qrcamera_get_all(qrcamera_code_t *codes, int max_codes) {
+    camera_frame_t fb;
+    int selected[QUIRC_MAX_GRIDS];
+    int decoded = 0;
+    int res;
+    reset_diag(&last_diag);
+    // Other cards may lie outside the window around the last one
+    qrcamera_full_view();
+    if (qrcamera_capture_frame(&fb) != ESP_OK) {
+        res = -2;
+    } else {
+        res = identify_frame(&fb, &last_diag);
+        if (res > 0) {
+            int n = select_grids(selected);
+            int i, j;
+            res = 0;
+            for (i = 0; i < n && res < max_codes; i++) {
+                qrcamera_code_t *code = &codes[res];
+                code->status = decode_code(selected[i], code->payload,
+                                           sizeof(code->payload), &last_diag);
+                if (code->status != 1) {
+                    code->payload[0] = 0;
+                }
+                for (j = 0; j < 4; j++) {
+                    frame_to_full(&fb, &qr_code.corners[j],
+                                  &code->corners[j].x, &code->corners[j].y);
+                }
+                decoded += code->status == 1;
+                res++;
+            }
+        }
+#if CONFIG_QRCAMERA_EXPOSURE_CONTROL
+        update_exposure(decoded ? 1 : res, true);
+#endif
+        qrcamera_release_frame(&fb);
+    }
+
+    // Counted in the stats as one read
+    last_diag.result = decoded ? 1 : (res > 0 ? -10 : res);
+    update_stats(&last_diag);
+    dump_diag(&last_diag);
+    ESP_LOGI(TAG, "Batch: %d codes, %d decoded", res > 0 ? res : 0, decoded);
     return res;
-}
\ No newline at end of file
+}
+
+void qrcamera_get_diag(qrcamera_diag_t *diag) {
+    portENTER_CRITICAL(&settings_lock);
+    *diag = last_diag;
+    portEXIT_CRITICAL(&settings_lock);
+}
+
+void qrcamera_get_stats(qrcamera_stats_t *out) {
+    portENTER_CRITICAL(&settings_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&settings_lock);
+}
+
+void qrcamera_reset_stats(void) {
+    portENTER_CRITICAL(&settings_lock);
+    memset(&stats, 0, sizeof(stats));
+    portEXIT_CRITICAL(&settings_lock);
+}
+
+#if CONFIG_QRCAMERA_PIPELINE
+/*
+ * Pipelined capture/decode
+ *
+ * The capture task keeps the flash on and pushes frames into a queue of
+ * depth one; the decode task on the other core consumes them. If the
+ * decoder is still busy when a new frame arrives, the queued (stale)
+ * frame is returned to the driver and replaced, so the decoder always
+ * works on the freshest frame and throughput is set by the slower stage.
+ * With three frame buffers the driver always has one to capture into.
+ *
+ * The driver must not be reprogrammed while the capture task waits in
+ * get() on the other core. While the pipeline runs, window, exposure and
+ * flash changes from the decode side (ROI tracking, exposure control) go
+ * through pipeline_source, which only records them; the capture task
+ * applies them between frames.
+ */
+
+typedef struct {
+    int res;
+    char payload[QRCAMERA_PIPELINE_PAYLOAD_SIZE];
+    qrcamera_diag_t diag;
+} pipeline_result_t;
+
+// A captured frame and when the capture task received it
+typedef struct {
+    camera_frame_t fb;
+    int64_t frame_at_us;
+} pipeline_frame_t;
+
+static QueueHandle_t frame_queue;
+static QueueHandle_t result_queue;
+static TaskHandle_t capture_task;
+static TaskHandle_t decode_task;
+static volatile bool pipeline_running;
+static uint32_t frames_dropped;
+// Set by the capture task before its first frame is queued
+static int64_t pipeline_flash_on_us;
+
+// Sensor changes waiting for the capture task
+typedef struct {
+    bool window;            // set_window pending
+    bool full_view;         // ... with NULL
+    camera_window_t next_window;
+    bool exposure;
+    int exposure_lines;
+    int gain;
+    bool flash;
+    int flash_percent;
+} sensor_request_t;
+
+static sensor_request_t request;
+static portMUX_TYPE request_lock = portMUX_INITIALIZER_UNLOCKED;
+// Set from start until both tasks have ended
+static volatile bool deferring;
+
+static esp_err_t deferred_init(int fb_count) {
+    return CAMERA_SOURCE.init(fb_count);
+}
+
+static esp_err_t deferred_get(camera_frame_t *frame) {
+    return CAMERA_SOURCE.get(frame);
+}
+
+static void deferred_put(camera_frame_t *frame) {
+    CAMERA_SOURCE.put(frame);
+}
+
+static void deferred_set_flash(int percent) {
+    if (!deferring) {
+        CAMERA_SOURCE.set_flash(percent);
+        return;
+    }
+    portENTER_CRITICAL(&request_lock);
+    request.flash = true;
+    request.flash_percent = percent;
+    portEXIT_CRITICAL(&request_lock);
+}
+
+static esp_err_t deferred_set_exposure(int exposure, int gain) {
+    if (!deferring) {
+        return CAMERA_SOURCE.set_exposure(exposure, gain);
+    }
+    portENTER_CRITICAL(&request_lock);
+    request.exposure = true;
+    request.exposure_lines = exposure;
+    request.gain = gain;
+    portEXIT_CRITICAL(&request_lock);
+    return ESP_OK;
+}
+
+static esp_err_t deferred_set_window(const camera_window_t *window) {
+    if (!deferring) {
+        return CAMERA_SOURCE.set_window(window);
+    }
+    portENTER_CRITICAL(&request_lock);
+    request.window = true;
+    request.full_view = !window;
+    if (window) {
+        request.next_window = *window;
+    }
+    portEXIT_CRITICAL(&request_lock);
+    return ESP_OK;
+}
+
+static void deferred_get_full_size(int *width, int *height) {
+    CAMERA_SOURCE.get_full_size(width, height);
+}
+
+static const camera_source_t pipeline_source = {
+    .name = "pipeline",
+    .init = deferred_init,
+    .get = deferred_get,
+    .put = deferred_put,
+    .set_flash = deferred_set_flash,
+    .set_exposure = deferred_set_exposure,
+    .set_window = deferred_set_window,
+    .get_full_size = deferred_get_full_size,
+};
+
+// Carry out the recorded changes; from the capture task between frames,
+// or once the pipeline has stopped. The flash only if it is to stay on.
+static void apply_requests(bool flash) {
+    sensor_request_t next;
+
+    portENTER_CRITICAL(&request_lock);
+    next = request;
+    memset(&request, 0, sizeof(request));
+    portEXIT_CRITICAL(&request_lock);
+    if (next.window) {
+        CAMERA_SOURCE.set_window(next.full_view ? NULL : &next.next_window);
+    }
+    if (next.exposure) {
+        CAMERA_SOURCE.set_exposure(next.exposure_lines, next.gain);
+    }
+    if (next.flash && flash) {
+        CAMERA_SOURCE.set_flash(next.flash_percent);
+    }
+}
+
+static void capture_loop(void *arg) {
+    pipeline_frame_t frame;
+    pipeline_frame_t stale;
+
+    pipeline_flash_on_us = esp_timer_get_time();
+    CAMERA_SOURCE.set_flash(flash_percent());
+    while (pipeline_running) {
+        apply_requests(true);
+        if (CAMERA_SOURCE.get(&frame.fb) != ESP_OK) {
+            ESP_LOGI(TAG, "Camera capture failed");
+            vTaskDelay(1);
+            continue;
+        }
+        frame.frame_at_us = esp_timer_get_time();
+        // Back-pressure: replace, never queue behind, an undecoded frame
+        if (xQueueReceive(frame_queue, &stale, 0) == pdTRUE) {
+            CAMERA_SOURCE.put(&stale.fb);
+            frames_dropped++;
+        }
+        xQueueSend(frame_queue, &frame, 0);
+    }
+    CAMERA_SOURCE.set_flash(0);
+
+    // Hand back anything not yet decoded
+    while (xQueueReceive(frame_queue, &stale, 0) == pdTRUE) {
+        CAMERA_SOURCE.put(&stale.fb);
+    }
+    capture_task = NULL;
+    vTaskDelete(NULL);
+}
+
+static void decode_loop(void *arg) {
+    pipeline_frame_t frame;
+    camera_frame_t fb;
+    pipeline_result_t result;
+
+    while (pipeline_running) {
+        if (xQueueReceive(frame_queue, &frame, 100 / portTICK_PERIOD_MS) != pdTRUE) {
+            continue;
+        }
+        fb = frame.fb;
+        reset_diag(&result.diag);
+        // The flash has been on since the pipeline started
+        result.diag.flash_on_at_us = pipeline_flash_on_us;
+        result.diag.frame_at_us = frame.frame_at_us;
+        if (cache_lookup(&fb, result.payload, sizeof(result.payload), &result.diag)) {
+            source->put(&fb);
+            result.res = 1;
+            result.diag.result = 1;
+            update_stats(&result.diag);
+            xQueueOverwrite(result_queue, &result);
+            continue;
+        }
+        result.res = process_frame_buffer(&fb, result.payload, sizeof(result.payload),
+                                          &result.diag);
+        cache_store(&fb, result.res, result.payload);
+#if CONFIG_QRCAMERA_ROI
+        roi_update(&fb, result.res);
+#endif
+#if CONFIG_QRCAMERA_EXPOSURE_CONTROL
+        // The flash stays on, so only the drive level can follow
+        if (update_exposure(result.res, false)) {
+            source->set_flash(exposure_flash_percent());
+        }
+#endif
+        source->put(&fb);
+        result.diag.result = result.res;
+        update_stats(&result.diag);
+        if (result.res == 1) {
+            // Only the latest successful read is of interest
+            xQueueOverwrite(result_queue, &result);
+        }
+    }
+    decode_task = NULL;
+    vTaskDelete(NULL);
+}
+
+static void pipeline_stop_tasks(void) {
+    pipeline_running = false;
+    // Both loops notice within one frame or queue timeout
+    while (capture_task || decode_task) {
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+    // Window and exposure changes still pending apply to the next read;
+    // the flash stays off
+    deferring = false;
+    apply_requests(false);
+}
+
+esp_err_t qrcamera_pipeline_start(void) {
+    if (pipeline_running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!frame_queue) {
+        frame_queue = xQueueCreate(1, sizeof(pipeline_frame_t));
+        result_queue = xQueueCreate(1, sizeof(pipeline_result_t));
+        if (!frame_queue || !result_queue) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    xQueueReset(result_queue);
+    frames_dropped = 0;
+    memset(&request, 0, sizeof(request));
+    deferring = true;
+    pipeline_running = true;
+
+    if (xTaskCreatePinnedToCore(capture_loop, "qr_capture", 3072, NULL,
+                                CONFIG_QRCAMERA_PIPELINE_PRIORITY, &capture_task,
+                                CONFIG_QRCAMERA_CAPTURE_CORE) != pdPASS) {
+        pipeline_running = false;
+        deferring = false;
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreatePinnedToCore(decode_loop, "qr_decode", CONFIG_QRCAMERA_DECODE_STACK_SIZE,
+                                NULL, CONFIG_QRCAMERA_PIPELINE_PRIORITY, &decode_task,
+                                !CONFIG_QRCAMERA_CAPTURE_CORE) != pdPASS) {
+        pipeline_stop_tasks();
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Pipeline started");
+    return ESP_OK;
+}
+
+int qrcamera_pipeline_get(char *out, size_t out_size, TickType_t timeout) {
+    pipeline_result_t result;
+
+    if (xQueueReceive(result_queue, &result, timeout) != pdTRUE) {
+        return 0;
+    }
+    portENTER_CRITICAL(&settings_lock);
+    last_diag = result.diag;
+    portEXIT_CRITICAL(&settings_lock);
+    if (strlen(result.payload) >= out_size) {
+        return -20;
+    }
+    strcpy(out, result.payload);
+    return result.res;
+}
+
+void qrcamera_pipeline_stop(void) {
+    pipeline_stop_tasks();
+    ESP_LOGI(TAG, "Pipeline stopped, %u stale frames dropped", (unsigned)frames_dropped);
+}
+#endif
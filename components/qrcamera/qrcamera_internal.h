@@ -0,0 +1,35 @@
+#ifndef __TANGIBLE_QRCAMERA_INTERNAL_H__
+#define __TANGIBLE_QRCAMERA_INTERNAL_H__
+
+#include <stddef.h>
+
+#include "sdkconfig.h"
+
+#include "esp_err.h"
+
+#include "camera_source.h"
+#include "qrcamera.h"
+
+// Capture path of qrcamera.c, for the layers built on top of it (slots.c, presence.c)
+
+// Flash and capture one frame; hand it back with qrcamera_release_frame
+esp_err_t qrcamera_capture_frame(camera_frame_t *fb);
+void qrcamera_release_frame(camera_frame_t *fb);
+
+// Gate, identify and decode a frame; return values as qrcamera_get.
+// The frame buffer is overwritten by thresholding.
+int process_frame_buffer(camera_frame_t *fb, char *out, size_t out_size,
+                         qrcamera_diag_t *diag);
+
+#if CONFIG_QRCAMERA_PRESENCE
+// Capture the full view scaled to out_width x out_height without flash and
+// at ambient exposure. The sensor stays in this mode until the next
+// qrcamera_capture_frame. Release with qrcamera_release_frame.
+esp_err_t qrcamera_capture_preview(camera_frame_t *fb, int out_width, int out_height);
+#endif
+
+// Capture the full sensor view from the next frame on (undo windowing)
+void qrcamera_full_view(void);
+void qrcamera_get_full_size(int *width, int *height);
+
+#endif
@@ -105,7 +105,7 @@ fail:
 	return -1;
 }
 
-int quirc_analyze_buffer(struct quirc *q, uint8_t *b, int w, int h) {
+int quirc_load_buffer(struct quirc *q, uint8_t *b, int w, int h) {
 	if (!QUIRC_PIXEL_ALIAS_IMAGE) {
 		// this method does not support separate pixel buffers
 		return -1;
@@ -116,6 +116,13 @@ int quirc_analyze_buffer(struct quirc *q, uint8_t *b, int w, int h) {
 	q->w = w;
 	q->h = h;
 	quirc_begin(q, NULL, NULL);
+	return 0;
+}
+
+int quirc_analyze_buffer(struct quirc *q, uint8_t *b, int w, int h) {
+	if (quirc_load_buffer(q, b, w, h) < 0)
+		return -1;
+
 	quirc_end(q);
 	return 0;
 }
@@ -125,6 +132,11 @@ int quirc_count(const struct quirc *q)
 	return q->num_grids;
 }
 
+void quirc_get_exposure(const struct quirc *q, struct quirc_exposure *exp)
+{
+	*exp = q->exposure;
+}
+
 static const char *const error_table[] = {
 	[QUIRC_SUCCESS] = "Success",
 	[QUIRC_ERROR_INVALID_GRID_SIZE] = "Invalid grid size",
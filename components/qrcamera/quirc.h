@@ -36,6 +36,15 @@ struct quirc;
  */
 int quirc_analyze_buffer(struct quirc *q, uint8_t *b, int w, int h);
 
+/* The same in steps, to time them: quirc_load_buffer takes the buffer
+ * as quirc_analyze_buffer does, then quirc_threshold binarizes it and
+ * quirc_identify searches it for codes. quirc_end is the two last steps.
+ * Added for tangible-firmware
+ */
+int quirc_load_buffer(struct quirc *q, uint8_t *b, int w, int h);
+void quirc_threshold(struct quirc *q);
+void quirc_identify(struct quirc *q);
+
 /* Obtain the library version string. */
 const char *quirc_version(void);
 
@@ -88,11 +97,31 @@ typedef enum {
 /* Return a string error message for an error code. */
 const char *quirc_strerror(quirc_decode_error_t err);
 
-/* Limits on the maximum size of QR-codes and their content. */
+/* Limits on the maximum size of QR-codes and their content. The maximum
+ * version may be lowered at compile time to shrink all buffers that
+ * depend on it; larger codes then fail with QUIRC_ERROR_INVALID_VERSION.
+ */
+#ifndef QUIRC_MAX_VERSION
 #define QUIRC_MAX_VERSION	40
+#endif
+#if QUIRC_MAX_VERSION < 1 || QUIRC_MAX_VERSION > 40
+#error "QUIRC_MAX_VERSION must be between 1 and 40"
+#endif
 #define QUIRC_MAX_GRID_SIZE	(QUIRC_MAX_VERSION * 4 + 17)
 #define QUIRC_MAX_BITMAP	(((QUIRC_MAX_GRID_SIZE * QUIRC_MAX_GRID_SIZE) + 7) / 8)
+#if QUIRC_MAX_VERSION == 40
 #define QUIRC_MAX_PAYLOAD	8896
+#else
+/* The codeword count is bounded by the bitmap size, and numeric mode,
+ * the densest, packs fewer than 2.5 characters per codeword.
+ */
+#define QUIRC_MAX_PAYLOAD	(QUIRC_MAX_BITMAP * 5 / 2)
+#endif
+
+/* Upper bound on the number of Reed-Solomon blocks in a code. This is
+ * exact for version 40 and generous for smaller versions.
+ */
+#define QUIRC_MAX_RS_BLOCKS	(QUIRC_MAX_VERSION * 2 + 1)
 
 /* QR-code ECC types. */
 #define QUIRC_ECC_LEVEL_M     0
@@ -151,6 +180,12 @@ struct quirc_data {
 	int			ecc_level;
 	int			mask;
 
+	/* Number of bit errors found across both copies of the format
+	 * information. 0 is a clean read; larger values indicate a
+	 * marginal code.
+	 */
+	int			format_distance;
+
 	/* This field is the highest-valued data type found in the QR
 	 * code.
 	 */
@@ -166,6 +201,46 @@ struct quirc_data {
 	uint32_t		eci;
 };
 
+/* This structure describes how cleanly a code was read. The fields are
+ * by-products of the normal extract and decode work, so collecting them
+ * costs next to nothing.
+ */
+struct quirc_diag {
+	/* Filled in by quirc_extract_diag(). The fitness is the score of
+	 * the final grid perspective against the expected timing, finder
+	 * and alignment patterns. The contrast is the grey-level gap
+	 * between the dark and light classes of the binarization threshold.
+	 */
+	int			fitness;
+	int			contrast;
+
+	/* Filled in by quirc_decode_diag(). The format distance is -1 and
+	 * num_blocks is 0 if decoding stopped before reaching them.
+	 * block_errors[i] is the number of bytes corrected in block i, out
+	 * of at most ecc_capacity correctable bytes per block.
+	 */
+	int			format_distance;
+	int			ecc_capacity;
+	int			num_blocks;
+	uint8_t			block_errors[QUIRC_MAX_RS_BLOCKS];
+};
+
+/* Brightness of the last processed image, from the histogram used to
+ * choose the binarization threshold. Levels are 0-255. The clipped
+ * fields give the share of pixels at 0 or 255, in thousandths.
+ */
+struct quirc_exposure {
+	int			threshold;
+	int			mean;
+	int			dark_mean;
+	int			light_mean;
+	int			clipped_low;
+	int			clipped_high;
+};
+
+/* Obtain the brightness statistics of the last processed image. */
+void quirc_get_exposure(const struct quirc *q, struct quirc_exposure *exp);
+
 /* Return the number of QR-codes identified in the last processed
  * image.
  */
@@ -175,10 +250,19 @@ int quirc_count(const struct quirc *q);
 void quirc_extract(const struct quirc *q, int index,
 		   struct quirc_code *code);
 
+/* As quirc_extract(), also filling in the extraction diagnostics. */
+void quirc_extract_diag(const struct quirc *q, int index,
+			struct quirc_code *code, struct quirc_diag *diag);
+
 /* Decode a QR-code, returning the payload data. */
 quirc_decode_error_t quirc_decode(const struct quirc_code *code,
 				  struct quirc_data *data);
 
+/* As quirc_decode(), also filling in the decode diagnostics. */
+quirc_decode_error_t quirc_decode_diag(const struct quirc_code *code,
+				       struct quirc_data *data,
+				       struct quirc_diag *diag);
+
 /* Flip a QR-code according to optional mirror feature of ISO 18004:2015 */
 void quirc_flip(struct quirc_code *code);
 
@@ -26,8 +26,12 @@
 #ifndef QUIRC_MAX_REGIONS
 #define QUIRC_MAX_REGIONS	254
 #endif
+#ifndef QUIRC_MAX_CAPSTONES
 #define QUIRC_MAX_CAPSTONES	32
+#endif
+#ifndef QUIRC_MAX_GRIDS
 #define QUIRC_MAX_GRIDS		8
+#endif
 #define QUIRC_PERSPECTIVE_PARAMS	8
 
 #if QUIRC_MAX_REGIONS < UINT8_MAX
@@ -73,6 +77,9 @@ struct quirc_grid {
 	/* Grid size and perspective transform */
 	int			grid_size;
 	double			c[QUIRC_PERSPECTIVE_PARAMS];
+
+	/* Fitness score of the perspective transform */
+	int			fitness;
 };
 
 struct quirc {
@@ -81,6 +88,9 @@ struct quirc {
 	int			w;
 	int			h;
 
+	/* Histogram statistics from choosing the threshold */
+	struct quirc_exposure	exposure;
+
 	int			num_regions;
 	struct quirc_region	regions[QUIRC_MAX_REGIONS];
 
@@ -95,7 +105,6 @@ struct quirc {
  * QR-code version information database
  */
 
-#define QUIRC_MAX_VERSION     40
 #define QUIRC_MAX_ALIGNMENT   7
 
 struct quirc_rs_params {
@@ -0,0 +1,68 @@
+#include <stdlib.h>
+
+#include "signature.h"
+
+#define SAMPLES_PER_SIDE 4
+
+void signature_compute(const uint8_t *buf, int stride,
+                       int x, int y, int width, int height,
+                       uint8_t *sig, int cols, int rows) {
+    int bx, by;
+
+    for (by = 0; by < rows; by++) {
+        int y0 = y + by * height / rows;
+        int y1 = y + (by + 1) * height / rows;
+        int ystep = (y1 - y0) / SAMPLES_PER_SIDE;
+        if (ystep < 1) {
+            ystep = 1;
+        }
+        for (bx = 0; bx < cols; bx++) {
+            int x0 = x + bx * width / cols;
+            int x1 = x + (bx + 1) * width / cols;
+            int xstep = (x1 - x0) / SAMPLES_PER_SIDE;
+            unsigned int sum = 0;
+            unsigned int count = 0;
+            int px, py;
+            if (xstep < 1) {
+                xstep = 1;
+            }
+            for (py = y0 + ystep / 2; py < y1; py += ystep) {
+                const uint8_t *row = buf + py * stride;
+                for (px = x0 + xstep / 2; px < x1; px += xstep) {
+                    sum += row[px];
+                    count++;
+                }
+            }
+            *sig++ = count ? sum / count : 0;
+        }
+    }
+}
+
+int signature_distance(const uint8_t *a, const uint8_t *b, int n, int *max_diff) {
+    int offset = 0;
+    int sad = 0;
+    int max = 0;
+    int i;
+
+    if (max_diff) {
+        *max_diff = 0;
+    }
+    if (n <= 0) {
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        offset += a[i] - b[i];
+    }
+    offset /= n;
+    for (i = 0; i < n; i++) {
+        int diff = abs(a[i] - b[i] - offset);
+        sad += diff;
+        if (diff > max) {
+            max = diff;
+        }
+    }
+    if (max_diff) {
+        *max_diff = max;
+    }
+    return sad / n;
+}
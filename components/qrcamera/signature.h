@@ -0,0 +1,20 @@
+#ifndef __TANGIBLE_SIGNATURE_H__
+#define __TANGIBLE_SIGNATURE_H__
+
+#include <stdint.h>
+
+// Block-mean signature of a frame region, for cheap change detection.
+// The region is divided into cols x rows blocks and each block reduced to
+// the mean of a sparse sample (about 4x4) of its pixels.
+void signature_compute(const uint8_t *buf, int stride,
+                       int x, int y, int width, int height,
+                       uint8_t *sig, int cols, int rows);
+
+// Mean absolute difference per block between two signatures of n blocks,
+// after removing the difference in overall brightness, so that flash or
+// exposure changes alone do not count as a change. The largest single
+// block difference is returned in *max_diff if non-NULL; it catches
+// changes confined to a few blocks that the mean dilutes.
+int signature_distance(const uint8_t *a, const uint8_t *b, int n, int *max_diff);
+
+#endif
@@ -0,0 +1,253 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "esp_log.h"
+
+#include "qrcamera_internal.h"
+#include "qrslots.h"
+#include "signature.h"
+
+static const char *TAG = "qrslots"; //for log
+
+// Signature blocks per slot
+#define SLOT_SIG_COLS 8
+#define SLOT_SIG_ROWS 8
+#define SLOT_SIG_SIZE (SLOT_SIG_COLS * SLOT_SIG_ROWS)
+
+typedef struct {
+    qrslot_region_t region;
+    bool present;
+    // Signature of the region when it was last read conclusively
+    bool has_signature;
+    uint8_t signature[SLOT_SIG_SIZE];
+    char payload[QRCAMERA_CODE_PAYLOAD_SIZE];
+} slot_t;
+
+static slot_t slots[CONFIG_QRCAMERA_SLOTS_MAX];
+static int slot_count;
+// Copy of one slot region, so that decoding one slot (which thresholds
+// its buffer in place) leaves the frame intact for the others
+static uint8_t *scratch;
+static size_t scratch_size;
+
+esp_err_t qrslots_configure(const qrslot_region_t *regions, int count) {
+    int full_w, full_h;
+    size_t largest = 0;
+    int i;
+
+    if (count < 0 || count > CONFIG_QRCAMERA_SLOTS_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    qrcamera_get_full_size(&full_w, &full_h);
+    for (i = 0; i < count; i++) {
+        const qrslot_region_t *r = &regions[i];
+        if (r->x < 0 || r->y < 0 || r->width <= 0 || r->height <= 0 ||
+            r->x + r->width > full_w || r->y + r->height > full_h) {
+            ESP_LOGE(TAG, "Slot %d outside the %dx%d view", i, full_w, full_h);
+            return ESP_ERR_INVALID_ARG;
+        }
+        if ((size_t)(r->width * r->height) > largest) {
+            largest = r->width * r->height;
+        }
+    }
+
+    if (largest > scratch_size) {
+        free(scratch);
+        scratch = malloc(largest);
+        scratch_size = scratch ? largest : 0;
+        if (!scratch) {
+            slot_count = 0;
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    memset(slots, 0, sizeof(slots));
+    for (i = 0; i < count; i++) {
+        slots[i].region = regions[i];
+    }
+    slot_count = count;
+    ESP_LOGI(TAG, "%d slots configured", count);
+    return ESP_OK;
+}
+
+esp_err_t qrslots_configure_grid(int cols, int rows) {
+    qrslot_region_t regions[CONFIG_QRCAMERA_SLOTS_MAX];
+    int full_w, full_h;
+    int c, r;
+
+    if (cols <= 0 || rows <= 0 || cols * rows > CONFIG_QRCAMERA_SLOTS_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    qrcamera_get_full_size(&full_w, &full_h);
+    for (r = 0; r < rows; r++) {
+        for (c = 0; c < cols; c++) {
+            qrslot_region_t *region = &regions[r * cols + c];
+            region->x = c * full_w / cols;
+            region->y = r * full_h / rows;
+            region->width = (c + 1) * full_w / cols - region->x;
+            region->height = (r + 1) * full_h / rows - region->y;
+        }
+    }
+    return qrslots_configure(regions, cols * rows);
+}
+
+// Reading order: rows top to bottom, slots left to right within a row.
+// Regions whose vertical centres are within half a height share a row.
+static bool reads_before(const qrslot_region_t *a, const qrslot_region_t *b) {
+    int dy = (a->y + a->height / 2) - (b->y + b->height / 2);
+    if (abs(dy) * 2 < a->height) {
+        return a->x < b->x;
+    }
+    return dy < 0;
+}
+
+int qrslots_calibrate(int margin_percent) {
+    static qrcamera_code_t codes[CONFIG_QRCAMERA_SLOTS_MAX];
+    qrslot_region_t regions[CONFIG_QRCAMERA_SLOTS_MAX];
+    int full_w, full_h;
+    int n, count = 0;
+    int i, j;
+
+    n = qrcamera_get_all(codes, CONFIG_QRCAMERA_SLOTS_MAX);
+    if (n < 0) {
+        return n;
+    }
+    qrcamera_get_full_size(&full_w, &full_h);
+    for (i = 0; i < n; i++) {
+        int x0 = full_w, y0 = full_h, x1 = 0, y1 = 0;
+        qrslot_region_t region;
+
+        if (codes[i].status != 1) {
+            continue;
+        }
+        for (j = 0; j < 4; j++) {
+            const qrcamera_point_t *p = &codes[i].corners[j];
+            x0 = p->x < x0 ? p->x : x0;
+            x1 = p->x > x1 ? p->x : x1;
+            y0 = p->y < y0 ? p->y : y0;
+            y1 = p->y > y1 ? p->y : y1;
+        }
+        int mx = (x1 - x0) * margin_percent / 100;
+        int my = (y1 - y0) * margin_percent / 100;
+        x0 = x0 - mx < 0 ? 0 : x0 - mx;
+        y0 = y0 - my < 0 ? 0 : y0 - my;
+        x1 = x1 + mx > full_w ? full_w : x1 + mx;
+        y1 = y1 + my > full_h ? full_h : y1 + my;
+        region.x = x0;
+        region.y = y0;
+        region.width = x1 - x0;
+        region.height = y1 - y0;
+
+        // Insertion sort into reading order
+        for (j = count; j > 0 && reads_before(&region, &regions[j - 1]); j--) {
+            regions[j] = regions[j - 1];
+        }
+        regions[j] = region;
+        count++;
+    }
+
+    esp_err_t err = qrslots_configure(regions, count);
+    if (err != ESP_OK) {
+        return -1;
+    }
+    return count;
+}
+
+static void add_event(qrslot_event_t *event, int slot, qrslot_event_type_t type,
+                      const char *payload) {
+    static const char *const names[] = {"inserted", "removed", "changed"};
+    event->slot = slot;
+    event->type = type;
+    strncpy(event->payload, payload, sizeof(event->payload) - 1);
+    event->payload[sizeof(event->payload) - 1] = 0;
+    ESP_LOGI(TAG, "Slot %d %s: %s", slot, names[type], payload);
+}
+
+int qrslots_scan(qrslot_event_t *events, int max_events) {
+    camera_frame_t fb;
+    const camera_window_t *w = &fb.window;
+    uint8_t sig[SLOT_SIG_SIZE];
+    char payload[QRCAMERA_CODE_PAYLOAD_SIZE];
+    qrcamera_diag_t diag;
+    int decoded = 0;
+    int n = 0;
+    int i, y;
+
+    qrcamera_full_view();
+    if (qrcamera_capture_frame(&fb) != ESP_OK) {
+        return -2;
+    }
+
+    for (i = 0; i < slot_count && n < max_events; i++) {
+        slot_t *slot = &slots[i];
+        camera_frame_t crop;
+
+        // Region in frame pixels; skipped while still windowed around it
+        int x0 = (slot->region.x - w->x) * (int)fb.width / w->width;
+        int y0 = (slot->region.y - w->y) * (int)fb.height / w->height;
+        int cw = slot->region.width * (int)fb.width / w->width;
+        int ch = slot->region.height * (int)fb.height / w->height;
+        if (x0 < 0 || y0 < 0 || x0 + cw > (int)fb.width || y0 + ch > (int)fb.height ||
+            cw <= 0 || ch <= 0) {
+            continue;
+        }
+
+        signature_compute(fb.buf, fb.width, x0, y0, cw, ch,
+                          sig, SLOT_SIG_COLS, SLOT_SIG_ROWS);
+        if (slot->has_signature) {
+            int change;
+            signature_distance(sig, slot->signature, SLOT_SIG_SIZE, &change);
+            if (change <= CONFIG_QRCAMERA_SLOT_CHANGE_THRESHOLD) {
+                continue;
+            }
+        }
+
+        for (y = 0; y < ch; y++) {
+            memcpy(scratch + y * cw, fb.buf + (y0 + y) * fb.width + x0, cw);
+        }
+        crop.buf = scratch;
+        crop.width = cw;
+        crop.height = ch;
+        crop.window.x = slot->region.x;
+        crop.window.y = slot->region.y;
+        crop.window.width = slot->region.width;
+        crop.window.height = slot->region.height;
+        crop.window.out_width = cw;
+        crop.window.out_height = ch;
+        crop.handle = NULL;
+
+        memset(&diag, 0, sizeof(diag));
+        int res = process_frame_buffer(&crop, payload, sizeof(payload), &diag);
+        decoded++;
+        if (res == 1) {
+            if (!slot->present) {
+                add_event(&events[n++], i, QRSLOT_INSERTED, payload);
+            } else if (strcmp(payload, slot->payload)) {
+                add_event(&events[n++], i, QRSLOT_CHANGED, payload);
+            }
+            slot->present = true;
+            strcpy(slot->payload, payload);
+        } else if (res == 0 || (res == -3 && (diag.gate == QRCAMERA_GATE_NO_FINDER ||
+                                              diag.gate == QRCAMERA_GATE_LOW_CONTRAST))) {
+            // Nothing there; an empty slot is usually featureless
+            if (slot->present) {
+                add_event(&events[n++], i, QRSLOT_REMOVED, "");
+            }
+            slot->present = false;
+            slot->payload[0] = 0;
+        } else {
+            // Inconclusive (blurred, failed to decode): read again next scan
+            slot->has_signature = false;
+            continue;
+        }
+        memcpy(slot->signature, sig, sizeof(sig));
+        slot->has_signature = true;
+    }
+
+    qrcamera_release_frame(&fb);
+    ESP_LOGI(TAG, "Scan: %d of %d slots decoded, %d events", decoded, slot_count, n);
+    return n;
+}
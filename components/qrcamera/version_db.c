@@ -28,6 +28,7 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 26, .dw = 13, .ns = 1}
 		    }
 	    },
+#if QUIRC_MAX_VERSION >= 2
 	    { /* Version 2 */
 		    .data_bytes = 44,
 		    .apat = {6, 18, 0},
@@ -38,6 +39,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 44, .dw = 22, .ns = 1}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 3
 	    { /* Version 3 */
 		    .data_bytes = 70,
 		    .apat = {6, 22, 0},
@@ -48,6 +51,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 35, .dw = 17, .ns = 2}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 4
 	    { /* Version 4 */
 		    .data_bytes = 100,
 		    .apat = {6, 26, 0},
@@ -58,6 +63,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 50, .dw = 24, .ns = 2}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 5
 	    { /* Version 5 */
 		    .data_bytes = 134,
 		    .apat = {6, 30, 0},
@@ -68,6 +75,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 33, .dw = 15, .ns = 2}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 6
 	    { /* Version 6 */
 		    .data_bytes = 172,
 		    .apat = {6, 34, 0},
@@ -78,6 +87,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 43, .dw = 19, .ns = 4}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 7
 	    { /* Version 7 */
 		    .data_bytes = 196,
 		    .apat = {6, 22, 38, 0},
@@ -88,6 +99,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 32, .dw = 14, .ns = 2}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 8
 	    { /* Version 8 */
 		    .data_bytes = 242,
 		    .apat = {6, 24, 42, 0},
@@ -98,6 +111,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 40, .dw = 18, .ns = 4}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 9
 	    { /* Version 9 */
 		    .data_bytes = 292,
 		    .apat = {6, 26, 46, 0},
@@ -108,6 +123,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 36, .dw = 16, .ns = 4}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 10
 	    { /* Version 10 */
 		    .data_bytes = 346,
 		    .apat = {6, 28, 50, 0},
@@ -118,6 +135,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 43, .dw = 19, .ns = 6}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 11
 	    { /* Version 11 */
 		    .data_bytes = 404,
 		    .apat = {6, 30, 54, 0},
@@ -128,6 +147,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 50, .dw = 22, .ns = 4}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 12
 	    { /* Version 12 */
 		    .data_bytes = 466,
 		    .apat = {6, 32, 58, 0},
@@ -138,6 +159,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 46, .dw = 20, .ns = 4}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 13
 	    { /* Version 13 */
 		    .data_bytes = 532,
 		    .apat = {6, 34, 62, 0},
@@ -148,6 +171,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 44, .dw = 20, .ns = 8}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 14
 	    { /* Version 14 */
 		    .data_bytes = 581,
 		    .apat = {6, 26, 46, 66, 0},
@@ -158,6 +183,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 36, .dw = 16, .ns = 11}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 15
 	    { /* Version 15 */
 		    .data_bytes = 655,
 		    .apat = {6, 26, 48, 70, 0},
@@ -168,6 +195,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 54, .dw = 24, .ns = 5}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 16
 	    { /* Version 16 */
 		    .data_bytes = 733,
 		    .apat = {6, 26, 50, 74, 0},
@@ -178,6 +207,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 43, .dw = 19, .ns = 15}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 17
 	    { /* Version 17 */
 		    .data_bytes = 815,
 		    .apat = {6, 30, 54, 78, 0},
@@ -188,6 +219,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 50, .dw = 22, .ns = 1}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 18
 	    { /* Version 18 */
 		    .data_bytes = 901,
 		    .apat = {6, 30, 56, 82, 0},
@@ -198,6 +231,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 50, .dw = 22, .ns = 17}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 19
 	    { /* Version 19 */
 		    .data_bytes = 991,
 		    .apat = {6, 30, 58, 86, 0},
@@ -208,6 +243,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 47, .dw = 21, .ns = 17}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 20
 	    { /* Version 20 */
 		    .data_bytes = 1085,
 		    .apat = {6, 34, 62, 90, 0},
@@ -218,6 +255,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 54, .dw = 24, .ns = 15}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 21
 	    { /* Version 21 */
 		    .data_bytes = 1156,
 		    .apat = {6, 28, 50, 72, 92, 0},
@@ -228,6 +267,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 50, .dw = 22, .ns = 17}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 22
 	    { /* Version 22 */
 		    .data_bytes = 1258,
 		    .apat = {6, 26, 50, 74, 98, 0},
@@ -238,6 +279,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 54, .dw = 24, .ns = 7}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 23
 	    { /* Version 23 */
 		    .data_bytes = 1364,
 		    .apat = {6, 30, 54, 78, 102, 0},
@@ -248,6 +291,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 54, .dw = 24, .ns = 11}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 24
 	    { /* Version 24 */
 		    .data_bytes = 1474,
 		    .apat = {6, 28, 54, 80, 106, 0},
@@ -258,6 +303,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 54, .dw = 24, .ns = 11}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 25
 	    { /* Version 25 */
 		    .data_bytes = 1588,
 		    .apat = {6, 32, 58, 84, 110, 0},
@@ -268,6 +315,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 54, .dw = 24, .ns = 7}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 26
 	    { /* Version 26 */
 		    .data_bytes = 1706,
 		    .apat = {6, 30, 58, 86, 114, 0},
@@ -278,6 +327,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 50, .dw = 22, .ns = 28}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 27
 	    { /* Version 27 */
 		    .data_bytes = 1828,
 		    .apat = {6, 34, 62, 90, 118, 0},
@@ -288,6 +339,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 53, .dw = 23, .ns = 8}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 28
 	    { /* Version 28 */
 		    .data_bytes = 1921,
 		    .apat = {6, 26, 50, 74, 98, 122, 0},
@@ -298,6 +351,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 54, .dw = 24, .ns = 4}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 29
 	    { /* Version 29 */
 		    .data_bytes = 2051,
 		    .apat = {6, 30, 54, 78, 102, 126, 0},
@@ -308,6 +363,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 53, .dw = 23, .ns = 1}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 30
 	    { /* Version 30 */
 		    .data_bytes = 2185,
 		    .apat = {6, 26, 52, 78, 104, 130, 0},
@@ -318,6 +375,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 54, .dw = 24, .ns = 15}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 31
 	    { /* Version 31 */
 		    .data_bytes = 2323,
 		    .apat = {6, 30, 56, 82, 108, 134, 0},
@@ -328,6 +387,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 54, .dw = 24, .ns = 42}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 32
 	    { /* Version 32 */
 		    .data_bytes = 2465,
 		    .apat = {6, 34, 60, 86, 112, 138, 0},
@@ -338,6 +399,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 54, .dw = 24, .ns = 10}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 33
 	    { /* Version 33 */
 		    .data_bytes = 2611,
 		    .apat = {6, 30, 58, 86, 114, 142, 0},
@@ -348,6 +411,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 54, .dw = 24, .ns = 29}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 34
 	    { /* Version 34 */
 		    .data_bytes = 2761,
 		    .apat = {6, 34, 62, 90, 118, 146, 0},
@@ -358,6 +423,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 54, .dw = 24, .ns = 44}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 35
 	    { /* Version 35 */
 		    .data_bytes = 2876,
 		    .apat = {6, 30, 54, 78, 102, 126, 150},
@@ -368,6 +435,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 54, .dw = 24, .ns = 39}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 36
 	    { /* Version 36 */
 		    .data_bytes = 3034,
 		    .apat = {6, 24, 50, 76, 102, 128, 154},
@@ -378,6 +447,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 54, .dw = 24, .ns = 46}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 37
 	    { /* Version 37 */
 		    .data_bytes = 3196,
 		    .apat = {6, 28, 54, 80, 106, 132, 158},
@@ -388,6 +459,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 54, .dw = 24, .ns = 49}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 38
 	    { /* Version 38 */
 		    .data_bytes = 3362,
 		    .apat = {6, 32, 58, 84, 110, 136, 162},
@@ -398,6 +471,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 54, .dw = 24, .ns = 48}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 39
 	    { /* Version 39 */
 		    .data_bytes = 3532,
 		    .apat = {6, 26, 54, 82, 110, 138, 166},
@@ -408,6 +483,8 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 54, .dw = 24, .ns = 43}
 		    }
 	    },
+#endif
+#if QUIRC_MAX_VERSION >= 40
 	    { /* Version 40 */
 		    .data_bytes = 3706,
 		    .apat = {6, 30, 58, 86, 114, 142, 170},
@@ -418,4 +495,5 @@ const struct quirc_version_info quirc_version_db[QUIRC_MAX_VERSION + 1] = {
 			    {.bs = 54, .dw = 24, .ns = 34}
 		    }
 	    }
+#endif
 };
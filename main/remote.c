@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "network.h"
+#include "qrcamera.h"
+#include "remote.h"
+
+static const char *TAG = "tgbl-remote"; //for log
+
+static TaskHandle_t notify_task;
+
+// "on"/"off" into *value
+static esp_err_t parse_switch(const char *arg, bool *value) {
+    if (!strcmp(arg, "on")) {
+        *value = true;
+    } else if (!strcmp(arg, "off")) {
+        *value = false;
+    } else {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+// A number, or "auto" for -1
+static esp_err_t parse_level(const char *arg, int *value) {
+    char *end;
+    if (!strcmp(arg, "auto")) {
+        *value = -1;
+        return ESP_OK;
+    }
+    long v = strtol(arg, &end, 10);
+    if (end == arg || *end || v < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *value = v;
+    return ESP_OK;
+}
+
+static esp_err_t set_command(const char *key, const char *arg) {
+    qrcamera_settings_t settings;
+    esp_err_t err;
+
+    qrcamera_get_settings(&settings);
+    if (!strcmp(key, "gate")) {
+        err = parse_switch(arg, &settings.gate);
+    } else if (!strcmp(key, "roi")) {
+        err = parse_switch(arg, &settings.roi);
+    } else if (!strcmp(key, "cache")) {
+        err = parse_switch(arg, &settings.frame_cache);
+    } else if (!strcmp(key, "flash")) {
+        err = parse_level(arg, &settings.flash_percent);
+    } else if (!strcmp(key, "lead")) {
+        err = parse_level(arg, &settings.flash_lead_ms);
+    } else {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    return qrcamera_set_settings(&settings);
+}
+
+static esp_err_t handle_command(const char *command) {
+    char verb[16], key[16], arg[16];
+    int n = sscanf(command, "%15s %15s %15s", verb, key, arg);
+
+    if (n == 3 && !strcmp(verb, "set")) {
+        return set_command(key, arg);
+    }
+    if (n == 1 && !strcmp(verb, "reread")) {
+        xTaskNotify(notify_task, REMOTE_NOTIFY_REREAD, eSetBits);
+        return ESP_OK;
+    }
+    if (n == 1 && !strcmp(verb, "dump")) {
+        xTaskNotify(notify_task, REMOTE_NOTIFY_DUMP, eSetBits);
+        return ESP_OK;
+    }
+    if (n == 1 && !strcmp(verb, "latency")) {
+        network_log_latency();
+        return ESP_OK;
+    }
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void remote_init(TaskHandle_t main_task) {
+    notify_task = main_task;
+    network_set_command_handler(handle_command);
+}
+
+static void send_frame(const uint8_t *buf, int width, int height, void *arg) {
+    esp_err_t err = network_send_frame(buf, width, height);
+    if (err != ESP_OK) {
+        ESP_LOGI(TAG, "Frame not sent: %s", esp_err_to_name(err));
+    }
+}
+
+void remote_dump_frame(void) {
+    if (qrcamera_dump_frame(send_frame, NULL) != ESP_OK) {
+        ESP_LOGI(TAG, "No frame to dump");
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef __TANGIBLE_REMOTE_H__
+#define __TANGIBLE_REMOTE_H__
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Commands from the server (network_set_command_handler):
+//
+//     set gate|roi|cache on|off    reader features, see qrcamera_settings_t
+//     set flash <percent>|auto     fixed flash drive, or exposure control
+//     set lead <ms>|auto           fixed flash lead time
+//     reread                       read the card in place again, and post it
+//     dump                         send the next captured frame to the server
+//     latency                      log the read latency percentiles, by stage
+//
+// Settings apply at once. reread and dump are carried out by the main
+// task, which gets these notification bits (next to the card sensor's):
+#define REMOTE_NOTIFY_REREAD (1 << 8)
+#define REMOTE_NOTIFY_DUMP (1 << 9)
+
+void remote_init(TaskHandle_t main_task);
+
+// Capture a frame and send it; from the main task, on REMOTE_NOTIFY_DUMP
+void remote_dump_frame(void);
+
+#endif
@@ -1,15 +1,35 @@
+#include <limits.h>
+#include <stdio.h>
+
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "driver/gpio.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
+#include "cardsensor.h"
 #include "network.h"
 #include "qrcamera.h"
+#include "remote.h"
+#if CONFIG_QRCAMERA_SLOTS
+#include "qrslots.h"
+#endif
+#if CONFIG_QRCAMERA_PRESENCE
+#include "qrpresence.h"
+#define LOOP_DELAY_MS CONFIG_QRCAMERA_PRESENCE_INTERVAL_MS
+#else
+// Retry interval while a card is in place but could not be read
+#define READ_RETRY_MS 100
+#endif
 
 #define QR_BUFFER_SIZE 128
+#if CONFIG_QRCAMERA_PIPELINE
+// Longest a burst of pipelined reads runs for one attempt
+#define QR_PIPELINE_TIMEOUT_MS 500
+#else
+// Immediate recaptures when the quality gate rejects a frame
+#define QR_GATE_RETRIES 5
+#endif
 
-static const gpio_num_t photo_drive_pin = GPIO_NUM_12;
-static const gpio_num_t photo_read_pin = GPIO_NUM_13;
 //static const gpio_num_t BLINK_GPIO = GPIO_NUM_33;
 
 static const char *TAG = "tgbl"; //for log
@@ -17,32 +37,138 @@ static const char *TAG = "tgbl"; //for log
 static char qr_buffer[QR_BUFFER_SIZE];
 //static uint8_t s_led_state = 0;
 
+#if CONFIG_QRCAMERA_PRESENCE
+// No photo sensor: the camera watches for cards between reads
+static void card_sensor_setup(void)
+{
+    qrpresence_calibrate();
+}
+
+static bool card_present;
+static int64_t card_arrived_us;
+
+bool card_sensor_read(void) {
+    int64_t now = esp_timer_get_time();
+    bool present = qrpresence_poll(NULL) == 1;
+    if (present && !card_present) {
+        // Arrived at most a poll interval before; the poll is the edge
+        card_arrived_us = now;
+    }
+    card_present = present;
+    return present;
+}
+
+// Start of the latency trace of a read
+static int64_t card_arrival_us(void) {
+    return card_arrived_us;
+}
+
+// Poll interval; wakes early for commands from the server
+static uint32_t wait_for_card_event(bool retry) {
+    uint32_t events = 0;
+    xTaskNotifyWait(0, ULONG_MAX, &events, LOOP_DELAY_MS / portTICK_PERIOD_MS);
+    return events;
+}
+#else
 static void card_sensor_setup(void)
 {
-    gpio_reset_pin(photo_read_pin);
-    gpio_set_direction(photo_read_pin, GPIO_MODE_INPUT);
-    gpio_reset_pin(photo_drive_pin);
-    gpio_set_direction(photo_drive_pin, GPIO_MODE_OUTPUT);
-    gpio_set_drive_capability(photo_drive_pin, GPIO_DRIVE_CAP_0); //~10mA
+    cardsensor_start(xTaskGetCurrentTaskHandle());
 }
 
 bool card_sensor_read(void) {
-    gpio_set_level(photo_drive_pin, 1);
-    vTaskDelay(1);
-    int read_level = gpio_get_level(photo_read_pin);
-    gpio_set_level(photo_drive_pin, 0);
-    return read_level == 1;
+    return cardsensor_present();
+}
+
+// Start of the latency trace of a read
+static int64_t card_arrival_us(void) {
+    return cardsensor_inserted_us();
+}
+
+// Sleep until the sensor reports a change, or until a failed read is due
+// to be retried. Returns the CARDSENSOR_NOTIFY_* bits received.
+static uint32_t wait_for_card_event(bool retry) {
+    uint32_t events = 0;
+    xTaskNotifyWait(0, ULONG_MAX, &events,
+                    retry ? READ_RETRY_MS / portTICK_PERIOD_MS : portMAX_DELAY);
+    return events;
+}
+#endif
+
+#if CONFIG_QRCAMERA_PIPELINE
+// Capture and decode on both cores until a frame decodes, so that a card
+// still settling into place is read from the first still frame
+static int read_card(void) {
+    int count;
+    if (qrcamera_pipeline_start() != ESP_OK) {
+        return -2;
+    }
+    count = qrcamera_pipeline_get(qr_buffer, QR_BUFFER_SIZE,
+                                  QR_PIPELINE_TIMEOUT_MS / portTICK_PERIOD_MS);
+    qrcamera_pipeline_stop();
+    return count;
+}
+#else
+static int read_card(void) {
+    int count;
+    int tries = 0;
+    do {
+        count = qrcamera_get(qr_buffer, QR_BUFFER_SIZE);
+    } while (count == -3 && ++tries < QR_GATE_RETRIES);
+    return count;
 }
+#endif
 
-bool attempt_qr_read(void) {
-    int count = qrcamera_get(qr_buffer, QR_BUFFER_SIZE);
+// arrived_us: when the card arrived, 0 if the read was not caused by a
+// card arriving
+bool attempt_qr_read(int64_t arrived_us) {
+    int count = read_card();
     if (count !=1) {
         return false;
     }
-    esp_err_t err = post_message(qr_buffer);
+    // Trace of the read that succeeded; the network adds its own points
+    qrcamera_diag_t diag;
+    network_trace_t trace = {0};
+    qrcamera_get_diag(&diag);
+    trace.us[NETWORK_TRACE_SENSOR] = arrived_us;
+    trace.us[NETWORK_TRACE_FLASH] = diag.flash_on_at_us;
+    trace.us[NETWORK_TRACE_FRAME] = diag.frame_at_us;
+    trace.us[NETWORK_TRACE_THRESHOLD] = diag.threshold_at_us;
+    trace.us[NETWORK_TRACE_IDENTIFY] = diag.identify_at_us;
+    trace.us[NETWORK_TRACE_DECODE] = diag.decoded_at_us;
+    esp_err_t err = post_message_traced(qr_buffer, &trace);
     return err==ESP_OK;
 }
 
+#if CONFIG_QRCAMERA_SLOTS
+#define SLOT_EVENTS_MAX 8
+
+// Multi-slot tables: no photo sensor, the camera watches all slots and
+// only slots that changed are decoded and posted
+static void slots_loop(void)
+{
+    static qrslot_event_t events[SLOT_EVENTS_MAX];
+    char msg[QRCAMERA_CODE_PAYLOAD_SIZE + 16];
+
+    qrslots_configure_grid(CONFIG_QRCAMERA_SLOT_COLUMNS, CONFIG_QRCAMERA_SLOT_ROWS);
+    while(true) {
+        int count = qrslots_scan(events, SLOT_EVENTS_MAX);
+        for (int i = 0; i < count; i++) {
+            if (events[i].type == QRSLOT_REMOVED) {
+                snprintf(msg, sizeof(msg), "%d:no card", events[i].slot);
+            } else {
+                snprintf(msg, sizeof(msg), "%d:%s", events[i].slot, events[i].payload);
+            }
+            post_message(msg);
+        }
+        uint32_t remote = 0;
+        xTaskNotifyWait(0, ULONG_MAX, &remote, 100 / portTICK_PERIOD_MS);
+        if (remote & REMOTE_NOTIFY_DUMP) {
+            remote_dump_frame();
+        }
+    }
+}
+#endif
+
 // default main task stacksize is 3584
 // set in menuconfig -> Component config -> Common ESP-related -> Main task stack size
 // raise stack size to 100000 (64000 still fails)
@@ -52,30 +178,58 @@ void app_main(void)
     network_init();
     ESP_LOGI(TAG, "Configuring camera");
     qrcamera_setup();
+    remote_init(xTaskGetCurrentTaskHandle());
+#if CONFIG_QRCAMERA_SLOTS
+    slots_loop();
+#endif
     ESP_LOGI(TAG, "Configuring photo sensor");
     card_sensor_setup();
 
     int state = 0;
     // 0: no card
     // 1: card, qr
+    uint32_t events = 0;
+    // Connection opened for the card in view
+    bool prewarmed = false;
+    // Reading again on request rather than for a card arriving
+    bool rereading = false;
 
     while(true) {
         int has_card = card_sensor_read();
         ESP_LOGI(TAG, "Loop start. State: %d, Has card: %d", state, has_card);
 
-        if (!has_card) {
+        if (events & REMOTE_NOTIFY_DUMP) {
+            remote_dump_frame();
+        }
+        if (events & REMOTE_NOTIFY_REREAD) {
+            // Read and post the card in place as if it had just arrived
+            state = 0;
+            rereading = true;
+        }
+
+        // A removal since the last pass may already have been followed by
+        // the next card
+        if (!has_card || (events & CARDSENSOR_NOTIFY_REMOVED)) {
             if (state==1) {
                 post_message("no card");
                 state=0;
             }
-        } else {
-            //has card
+            prewarmed = false;
+            rereading = false;
+        }
+        if (has_card) {
             if (state==0) {
-                if (attempt_qr_read()) {
+                // Connect (and handshake) while the camera reads the card
+                if (!prewarmed) {
+                    network_prewarm();
+                    prewarmed = true;
+                }
+                if (attempt_qr_read(rereading ? 0 : card_arrival_us())) {
                     state=1;
+                    rereading = false;
                 }
             }
         }
-        vTaskDelay(100 / portTICK_PERIOD_MS);
+        events = wait_for_card_event(has_card && state==0);
     }
 }
\ No newline at end of file
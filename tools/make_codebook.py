@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+"""Build a known-card codebook blob for qrcamera_set_codebook().
+
+Each line of the input file is one card payload. The QR parameters must
+match the ones used when printing the cards, otherwise the cell bitmaps
+will not line up with what the camera extracts.
+
+    tools/make_codebook.py cards.txt codebook.bin --ecc M
+
+Point CONFIG_QRCAMERA_CODEBOOK_FILE at the output to embed it in the
+firmware, or pass it to qrcamera_set_codebook() at run time.
+
+Requires the `qrcode` package.
+"""
+import argparse
+import struct
+
+import qrcode
+
+ECC = {
+    'L': qrcode.constants.ERROR_CORRECT_L,
+    'M': qrcode.constants.ERROR_CORRECT_M,
+    'Q': qrcode.constants.ERROR_CORRECT_Q,
+    'H': qrcode.constants.ERROR_CORRECT_H,
+}
+
+
+def cell_bitmap(matrix):
+    """Pack a module matrix like quirc_code.cell_bitmap (bit i = y*size+x)."""
+    size = len(matrix)
+    out = bytearray((size * size + 7) // 8)
+    for y, row in enumerate(matrix):
+        for x, black in enumerate(row):
+            if black:
+                i = y * size + x
+                out[i >> 3] |= 1 << (i & 7)
+    return out
+
+
+def entry(payload, args):
+    qr = qrcode.QRCode(version=args.version, border=0,
+                       error_correction=ECC[args.ecc],
+                       mask_pattern=args.mask)
+    qr.add_data(payload)
+    qr.make(fit=args.version is None)
+    matrix = qr.get_matrix()
+    data = payload.encode()
+    if len(data) > 255:
+        raise ValueError('payload too long: %r' % payload)
+    return struct.pack('<BB', len(matrix), len(data)) + data + cell_bitmap(matrix)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('cards', help='text file, one payload per line')
+    parser.add_argument('output', help='codebook blob to write')
+    parser.add_argument('--version', type=int, default=None,
+                        help='fixed QR version (default: smallest that fits)')
+    parser.add_argument('--ecc', choices=ECC.keys(), default='M')
+    parser.add_argument('--mask', type=int, default=None,
+                        help='fixed mask pattern 0-7 (default: best)')
+    args = parser.parse_args()
+
+    with open(args.cards) as f:
+        payloads = [line.rstrip('\n') for line in f if line.strip()]
+
+    blob = b'TGCB' + struct.pack('<H', len(payloads))
+    for payload in payloads:
+        blob += entry(payload, args)
+
+    with open(args.output, 'wb') as f:
+        f.write(blob)
+    print('%d cards, %d bytes' % (len(payloads), len(blob)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,55 @@
+#!/bin/sh
+# Report static RAM and peak decode stack use of the quirc capacity profiles
+# (see components/qrcamera/Kconfig).
+#
+# Builds the decoder with the host compiler, so absolute numbers differ
+# from the xtensa build (pointers and alignment), but the relative cost
+# of each profile carries over. Use `idf.py size-components` for the
+# exact static footprint of the configured firmware.
+#
+# Usage: tools/quirc_size_report.sh [cc]
+
+set -e
+
+CC=${1:-${CC:-cc}}
+SRC=$(cd "$(dirname "$0")/../components/qrcamera" && pwd)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+cat > "$TMP/sizes.c" <<'EOC'
+#include <stdio.h>
+#include "quirc_internal.h"
+int main(void)
+{
+	printf("%zu %zu %zu %zu\n",
+	       sizeof(struct quirc), sizeof(struct quirc_code),
+	       sizeof(struct quirc_data), sizeof(quirc_version_db));
+	return 0;
+}
+EOC
+
+# name version grids capstones regions
+PROFILES="cards:6:2:12:254 multi:6:8:32:254 full:40:8:32:254"
+
+printf '%-8s %7s %7s %7s %7s %10s %12s\n' \
+	profile version quirc code data version_db "decode stack"
+for p in $PROFILES; do
+	IFS=: read name ver grids caps regions <<EOP
+$p
+EOP
+	DEFS="-DQUIRC_MAX_VERSION=$ver -DQUIRC_MAX_GRIDS=$grids"
+	DEFS="$DEFS -DQUIRC_MAX_CAPSTONES=$caps -DQUIRC_MAX_REGIONS=$regions"
+
+	$CC -O2 $DEFS -I"$SRC" -o "$TMP/sizes" "$TMP/sizes.c" "$SRC/version_db.c"
+	(cd "$TMP" && $CC -O2 $DEFS -fstack-usage -c "$SRC/decode.c")
+
+	set -- $("$TMP/sizes")
+	# quirc_decode's own frame (holding struct datastream) plus the
+	# deepest callee frame is a close upper bound on peak decode stack.
+	dstack=$(awk -F'\t' '
+		/:quirc_decode\t/ { top = $2; next }
+		$2 > callee { callee = $2 }
+		END { print top + callee }' "$TMP/decode.su")
+	printf '%-8s %7s %7s %7s %7s %10s %12s\n' \
+		"$name" "$ver" "$1" "$2" "$3" "$4" "$dstack"
+done
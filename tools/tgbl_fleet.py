@@ -0,0 +1,520 @@
+#!/usr/bin/env python3
+"""Load generator for the /tgbl endpoint: a fleet of simulated readers.
+
+Each simulated device runs the card loop of app_main
+(main/tangible_firmware_main.c) and the outbound path of
+components/network/outbox.c. Cards arrive and are taken away at random.
+Each arrival opens the connection ahead (network_prewarm) and is read,
+with reads failing now and then and retried. A card read is posted, and
+its removal is posted as "no card". The messages are batched, numbered,
+and sent over a keep-alive HTTP connection. A failed send is retried once
+on a new connection, then kept in the ring and sent again later, oldest
+first. WiFi drops out now and then: messages then wait in the ring, and go
+out when the link is back.
+
+The fleet grows in steps, and each step runs for a while and prints a row:
+
+    tools/tgbl_ingest_server.py --port 8080 &
+    tools/tgbl_fleet.py --server 127.0.0.1:8080 --devices 10,100,500
+    devices  posted/s  server ev/s  req/s  p50 ms  p95 ms  p99 ms  dup  lost  dropped
+         10       4.7          4.7    3.6      45    1721    2192    0     0        0
+        100      51.4         49.5   41.2      45     281    1659    1     0        0
+    ...
+
+posted/s counts messages posted by the devices. The server columns come
+from the server's own counts, read from GET /tgbl/stats
+(tools/tgbl_ingest_server.py) before and after the step. They show "-"
+against a server without that endpoint. The latency runs from
+post_message to the server's answer. It includes batching, time in the
+ring and retries, as the firmware's NETWORK_TRACE_ENQUEUE to
+NETWORK_TRACE_ACK stages do. dropped counts messages a device gave up:
+the queue was full, or the ring overflowed.
+
+Once the last step is done, the devices stop reading cards and send what
+they still hold. The run ends with the totals: messages posted, messages
+the server counted once, and the difference. The server's lost count
+(gaps in a device's sequence numbers) misses messages dropped before the
+device's first one arrived; the totals do not.
+
+The outbox settings default to those of sdkconfig; --help lists them.
+Every device opens one connection, so large fleets may need a higher open
+file limit (ulimit -n) for both this tool and the server.
+"""
+import argparse
+import asyncio
+import collections
+import json
+import os
+import random
+import resource
+import time
+
+PREWARM = 'prewarm'     # queue markers, as SEQ_PREWARM and SEQ_LINK_UP
+LINK_UP = 'link up'
+READ_RETRY_S = 0.1      # READ_RETRY_MS
+
+
+def now():
+    return time.monotonic()
+
+
+def percentile(values, percent):
+    if not values:
+        return 0
+    values = sorted(values)
+    return values[min(len(values) - 1, len(values) * percent // 100)]
+
+
+def escape(msg):
+    return msg.replace('\\', '\\\\').replace('\n', '\\n')
+
+
+class Stats:
+    def __init__(self):
+        self.posted = 0
+        self.acked = 0
+        self.refused = 0
+        self.queue_drops = 0
+        self.ring_drops = 0
+        self.requests = 0
+        self.failures = 0
+        self.connects = 0
+        self.outages = 0
+        self.latencies_ms = []  # since the step started
+
+    def dropped(self):
+        return self.queue_drops + self.ring_drops
+
+
+class Event:
+    def __init__(self, msg):
+        self.msg = msg
+        self.posted = now()
+        self.seq = None
+
+
+class HttpTransport:
+    """transport_http.c: one keep-alive connection, reopened as needed."""
+
+    def __init__(self, device, args, stats):
+        self.device = device
+        self.host, self.port = args.host, args.port
+        self.timeout = args.timeout_ms / 1000
+        self.keepalive_idle = args.keepalive_idle_ms / 1000
+        self.stats = stats
+        self.reader = self.writer = None
+        self.last_exchange = 0
+
+    def close(self):
+        if self.writer:
+            self.writer.close()
+        self.reader = self.writer = None
+
+    async def exchange(self, method, body):
+        if not self.writer:
+            if not self.device.link:
+                raise ConnectionError('WiFi down')
+            self.reader, self.writer = await asyncio.open_connection(self.host, self.port)
+            self.stats.connects += 1
+        head = ('%s /tgbl HTTP/1.1\r\nHost: %s\r\nContent-Type: text/x-tgbl-batch\r\n'
+                'X-Tgbl-Device: %s\r\nContent-Length: %d\r\n\r\n' % (
+                    method, self.host, self.device.name, len(body)))
+        self.writer.write(head.encode() + body)
+        await self.writer.drain()
+        status = int((await self.reader.readline()).split()[1])
+        length, closing = 0, False
+        while True:
+            line = (await self.reader.readline()).decode('latin-1').strip()
+            if not line:
+                break
+            name, _, value = line.partition(':')
+            name, value = name.strip().lower(), value.strip().lower()
+            if name == 'content-length':
+                length = int(value)
+            elif name == 'connection' and value == 'close':
+                closing = True
+        if method != 'HEAD' and length:
+            await self.reader.readexactly(length)
+        self.last_exchange = time.monotonic()
+        if closing:
+            self.close()
+        return status
+
+    async def perform(self, method, body=b''):
+        """Status code, or None if the request failed."""
+        try:
+            return await asyncio.wait_for(self.exchange(method, body), self.timeout)
+        except (OSError, asyncio.TimeoutError, asyncio.IncompleteReadError,
+                ValueError, IndexError):
+            self.close()
+            return None
+
+    def close_if_idle(self):
+        if self.writer and time.monotonic() - self.last_exchange >= self.keepalive_idle:
+            self.close()
+
+    async def send(self, events, ages_ms):
+        """'ok', 'refused' (for good) or 'fail', as transport_send."""
+        self.close_if_idle()
+        body = ''.join('%d %d %s\n' % (e.seq, age, escape(e.msg))
+                       for e, age in zip(events, ages_ms)).encode()
+        self.stats.requests += 1
+        status = await self.perform('POST', body)
+        if status is None:
+            # Perhaps a connection the server had closed: once more, anew
+            status = await self.perform('POST', body)
+        if status is None or status >= 500:
+            self.close()
+            return 'fail'
+        if 200 <= status < 300:
+            return 'ok'
+        # Only a batch the server cannot parse or take is refused for good
+        return 'refused' if status in (400, 413, 415) else 'fail'
+
+    async def prewarm(self):
+        self.close_if_idle()
+        if not self.writer:
+            await self.perform('HEAD')
+
+
+class Outbox:
+    """outbox.c: queue, batches, and the ring of unsent messages."""
+
+    def __init__(self, device, args, stats):
+        self.device = device
+        self.args = args
+        self.stats = stats
+        self.transport = HttpTransport(device, args, stats)
+        self.queue = asyncio.Queue(args.queue_length)
+        self.ring = collections.deque()
+        self.next_seq = 0
+        self.rtt_ms = 2 * args.batch_window_max_ms
+        self.link_came_up = False
+        self.busy = False
+
+    def idle(self):
+        return self.queue.empty() and not self.ring and not self.busy
+
+    def post(self, msg):
+        if self.queue.full():
+            self.stats.queue_drops += 1
+            return False
+        self.queue.put_nowait(Event(msg))
+        self.stats.posted += 1
+        return True
+
+    def post_marker(self, marker):
+        if not self.queue.full():
+            self.queue.put_nowait(marker)
+
+    def prewarm(self):
+        # Pointless if messages are already waiting to go
+        if self.queue.empty():
+            self.post_marker(PREWARM)
+
+    def take_seq(self, event):
+        event.seq = self.next_seq
+        self.next_seq += 1
+
+    def ring_push(self, event):
+        if len(self.ring) == self.args.ring_size:
+            self.ring.popleft()
+            self.stats.ring_drops += 1
+        self.ring.append(event)
+
+    async def send_batch(self, batch):
+        start = now()
+        result = await self.transport.send(batch, [int((start - e.posted) * 1000)
+                                                   for e in batch])
+        end = now()
+        if result == 'ok':
+            self.rtt_ms = (7 * self.rtt_ms + (end - start) * 1000) / 8
+            self.stats.acked += len(batch)
+            self.stats.latencies_ms.extend((end - e.posted) * 1000 for e in batch)
+        elif result == 'refused':
+            self.stats.refused += len(batch)
+        else:
+            self.stats.failures += 1
+        return result != 'fail'
+
+    async def collect(self, batch):
+        window = min(self.rtt_ms / 2, self.args.batch_window_max_ms) / 1000
+        deadline = now() + window
+        while len(batch) < self.args.batch_max:
+            try:
+                item = await asyncio.wait_for(self.queue.get(), max(0, deadline - now()))
+            except asyncio.TimeoutError:
+                break
+            if item in (PREWARM, LINK_UP):
+                # About to send anyway
+                self.link_came_up |= item == LINK_UP
+                continue
+            self.take_seq(item)
+            batch.append(item)
+
+    async def batch_send(self, batch):
+        sent = False
+        if not self.ring and self.device.link:
+            sent = await self.send_batch(batch)
+        if not sent:
+            for event in batch:
+                self.ring_push(event)
+        return sent
+
+    async def ring_replay(self):
+        if not self.device.link:
+            return False
+        while self.ring:
+            batch = list(self.ring)[:self.args.batch_max]
+            if not await self.send_batch(batch):
+                return False
+            for _ in batch:
+                self.ring.popleft()
+        return True
+
+    async def run(self):
+        retry = self.args.retry_ms / 1000
+        last_failure = now() - retry
+        while True:
+            wait = None
+            if self.ring:
+                wait = max(0, retry - (now() - last_failure))
+            try:
+                item = await asyncio.wait_for(self.queue.get(), wait)
+            except asyncio.TimeoutError:
+                item = None     # retry interval over
+            self.busy = True
+            if item == PREWARM:
+                if self.device.link:
+                    await self.transport.prewarm()
+            elif item == LINK_UP:
+                self.link_came_up = True
+                await self.transport.prewarm()
+            elif item is not None:
+                self.take_seq(item)
+                batch = [item]
+                await self.collect(batch)
+                if not await self.batch_send(batch):
+                    last_failure = now()
+            if self.link_came_up:
+                self.link_came_up = False
+                last_failure = now() - retry
+            if self.ring and now() - last_failure >= retry:
+                if not await self.ring_replay():
+                    last_failure = now()
+            self.busy = False
+
+
+class Device:
+    def __init__(self, name, args, stats, seed):
+        self.name = name
+        self.args = args
+        self.stats = stats
+        self.random = random.Random(seed)
+        self.link = True
+        self.outbox = Outbox(self, args, stats)
+        self.tasks = []
+
+    def start(self):
+        self.tasks = [asyncio.create_task(self.outbox.run()),
+                      asyncio.create_task(self.cards()),
+                      asyncio.create_task(self.wifi())]
+
+    def stop_cards(self):
+        for task in self.tasks[1:]:
+            task.cancel()
+        if not self.link:
+            self.link = True
+            self.outbox.post_marker(LINK_UP)
+
+    def stop(self):
+        for task in self.tasks:
+            task.cancel()
+        self.outbox.transport.close()
+
+    async def cards(self):
+        args, rnd = self.args, self.random
+        # Spread the fleet's first arrivals
+        await asyncio.sleep(rnd.uniform(0, args.idle))
+        while True:
+            await asyncio.sleep(rnd.expovariate(1 / args.idle))
+            # Card in place
+            self.outbox.prewarm()
+            removal = now() + rnd.expovariate(1 / args.dwell)
+            card = 'card-%d' % rnd.randrange(args.cards)
+            state = 0
+            while state == 0 and now() < removal:
+                await asyncio.sleep(rnd.uniform(0.5, 1.5) * args.read_ms / 1000)
+                if rnd.random() >= args.read_fail and self.outbox.post(card):
+                    state = 1
+                else:
+                    await asyncio.sleep(READ_RETRY_S)
+            await asyncio.sleep(max(0, removal - now()))
+            if state == 1:
+                self.outbox.post('no card')
+
+    async def wifi(self):
+        args, rnd = self.args, self.random
+        if args.outages <= 0:
+            return
+        while True:
+            await asyncio.sleep(rnd.expovariate(args.outages / 3600))
+            self.link = False
+            self.outbox.transport.close()
+            self.stats.outages += 1
+            await asyncio.sleep(rnd.expovariate(1 / args.outage_s))
+            self.link = True
+            self.outbox.post_marker(LINK_UP)
+
+
+async def server_stats(args):
+    """The server's totals from GET /tgbl/stats, or None."""
+    try:
+        reader, writer = await asyncio.wait_for(
+            asyncio.open_connection(args.host, args.port), 5)
+        writer.write(('GET /tgbl/stats HTTP/1.1\r\nHost: %s\r\n'
+                      'Connection: close\r\n\r\n' % args.host).encode())
+        response = await asyncio.wait_for(reader.read(), 5)
+        writer.close()
+        head, _, body = response.partition(b'\r\n\r\n')
+        if b' 200 ' not in head.split(b'\r\n')[0]:
+            return None
+        return json.loads(body)
+    except (OSError, asyncio.TimeoutError, ValueError):
+        return None
+
+
+def server_column(before, after, key, width, per_s=None):
+    if before is None or after is None:
+        return '%*s' % (width, '-')
+    diff = after[key] - before[key]
+    if per_s:
+        return '%*.1f' % (width, diff / per_s)
+    return '%*d' % (width, diff)
+
+
+async def run(args):
+    stats = Stats()
+    devices = []
+    prefix = args.prefix or 'fleet-%d-' % os.getpid()
+    start_stats = await server_stats(args)
+    if start_stats is None:
+        print('Server at %s:%d has no /tgbl/stats, server columns left out' % (
+            args.host, args.port))
+    print('devices  posted/s  server ev/s  req/s  p50 ms  p95 ms  p99 ms'
+          '  dup  lost  dropped', flush=True)
+
+    for count in args.devices:
+        while len(devices) < count:
+            device = Device('%s%05d' % (prefix, len(devices)), args, stats,
+                            args.seed * 100003 + len(devices))
+            device.start()
+            devices.append(device)
+        before = await server_stats(args)
+        posted, dropped = stats.posted, stats.dropped()
+        stats.latencies_ms = []
+        started = now()
+        await asyncio.sleep(args.duration)
+        elapsed = now() - started
+        after = await server_stats(args)
+        latencies = stats.latencies_ms
+        print('%7d  %8.1f  %s  %s  %6.0f  %6.0f  %6.0f  %s  %s  %7d' % (
+            count, (stats.posted - posted) / elapsed,
+            server_column(before, after, 'events', 11, elapsed),
+            server_column(before, after, 'requests', 5, elapsed),
+            percentile(latencies, 50), percentile(latencies, 95),
+            percentile(latencies, 99),
+            server_column(before, after, 'duplicates', 3),
+            server_column(before, after, 'lost', 4),
+            stats.dropped() - dropped), flush=True)
+
+    # Stop reading cards and send what is left
+    for device in devices:
+        device.stop_cards()
+    deadline = now() + args.drain
+    while now() < deadline and not all(d.outbox.idle() for d in devices):
+        await asyncio.sleep(0.2)
+    pending = sum(d.outbox.queue.qsize() + len(d.outbox.ring) for d in devices)
+    for device in devices:
+        device.stop()
+    end_stats = await server_stats(args)
+
+    print('\nPosted %d, acked %d, refused %d, dropped %d (queue %d, ring %d), '
+          'unsent %d' % (stats.posted, stats.acked, stats.refused, stats.dropped(),
+                         stats.queue_drops, stats.ring_drops, pending))
+    print('%d requests, %d failed, %d connections, %d WiFi outages' % (
+        stats.requests, stats.failures, stats.connects, stats.outages))
+    if start_stats is not None and end_stats is not None:
+        received = end_stats['events'] - start_stats['events']
+        expected = stats.posted - stats.refused - stats.ring_drops - pending
+        print('Server counted %d once, %d duplicates, %d missing of %d expected, '
+              '%d gaps in sequence numbers' % (
+                  received, end_stats['duplicates'] - start_stats['duplicates'],
+                  expected - received, expected,
+                  end_stats['lost'] - start_stats['lost']))
+
+
+def raise_file_limit():
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    if soft < hard:
+        resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--server', default='127.0.0.1:80', metavar='HOST:PORT')
+    parser.add_argument('--devices', default='10,100', metavar='N,N,...',
+                        help='fleet size of each step')
+    parser.add_argument('--duration', type=float, default=60, metavar='S',
+                        help='length of each step')
+    parser.add_argument('--drain', type=float, default=30, metavar='S',
+                        help='longest wait for the devices to send the rest')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--prefix', help='device name prefix (default: per run)')
+
+    cards = parser.add_argument_group('cards')
+    cards.add_argument('--idle', type=float, default=10, metavar='S',
+                       help='mean time without a card')
+    cards.add_argument('--dwell', type=float, default=5, metavar='S',
+                       help='mean time a card stays in place')
+    cards.add_argument('--read-ms', type=float, default=300,
+                       help='mean time to read a card')
+    cards.add_argument('--read-fail', type=float, default=0.1, metavar='P',
+                       help='share of reads that fail and are retried')
+    cards.add_argument('--cards', type=int, default=50, help='distinct cards')
+
+    link = parser.add_argument_group('WiFi')
+    link.add_argument('--outages', type=float, default=2, metavar='PER_HOUR',
+                      help='WiFi outages per device and hour')
+    link.add_argument('--outage-s', type=float, default=10, metavar='S',
+                      help='mean length of an outage')
+
+    outbox = parser.add_argument_group('outbox (sdkconfig)')
+    outbox.add_argument('--queue-length', type=int, default=16,
+                        help='CONFIG_NETWORK_QUEUE_LENGTH')
+    outbox.add_argument('--ring-size', type=int, default=32,
+                        help='CONFIG_NETWORK_RING_SIZE')
+    outbox.add_argument('--retry-ms', type=int, default=5000,
+                        help='CONFIG_NETWORK_RETRY_MS')
+    outbox.add_argument('--batch-max', type=int, default=16,
+                        help='CONFIG_NETWORK_BATCH_MAX')
+    outbox.add_argument('--batch-window-max-ms', type=int, default=50,
+                        help='CONFIG_NETWORK_BATCH_WINDOW_MAX_MS')
+    outbox.add_argument('--timeout-ms', type=int, default=5000,
+                        help='HTTP client timeout')
+    outbox.add_argument('--keepalive-idle-ms', type=int, default=5000,
+                        help='CONFIG_NETWORK_HTTP_KEEPALIVE_IDLE_MS')
+    args = parser.parse_args()
+
+    args.host, _, port = args.server.rpartition(':')
+    args.port = int(port)
+    args.devices = [int(n) for n in args.devices.split(',')]
+    raise_file_limit()
+    try:
+        asyncio.run(run(args))
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
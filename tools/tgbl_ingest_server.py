@@ -0,0 +1,225 @@
+#!/usr/bin/env python3
+"""Reference ingest server for the /tgbl endpoint, for load tests.
+
+Implements the device side of the HTTP transport (NETWORK_TRANSPORT_HTTP)
+the way a backend should, without logging every message: batches of type
+text/x-tgbl-batch (see tools/tgbl_server.py) are accepted over keep-alive
+connections, HEAD requests that open a connection ahead are answered
+empty, and every few seconds a summary is printed:
+
+    tools/tgbl_ingest_server.py --port 8080
+    [10 s] 412 events/s in 98 requests/s, 100 connections
+           service p50 0.2 p99 1.1 ms, age p50 3 p99 48 ms
+           duplicates 0, lost 0
+
+Events are checked per X-Tgbl-Device by sequence number. A number seen
+before is a duplicate (acked, not counted again); numbers skipped over are
+counted as lost until they turn up. Numbers below the first one received
+from a device are not known, so are not counted. A device that reboots
+skips up to 64 numbers (SEQ_RESERVE in components/network/outbox.c),
+which counts as lost here; the simulated fleet (tools/tgbl_fleet.py) does
+not reboot.
+
+GET /tgbl/stats returns the running totals as JSON, which is how
+tools/tgbl_fleet.py reads the server's view of each load step.
+
+--delay-ms adds a fixed processing time per request, to model a slower
+backend. --drop-responses P closes the connection instead of answering a
+share P (0..1) of batches after accepting them, as a lost response would,
+so that the duplicates of the devices' resends show up.
+"""
+import argparse
+import asyncio
+import json
+import random
+import resource
+import time
+
+from tgbl_server import parse_batch
+
+
+def percentile(values, percent):
+    if not values:
+        return 0
+    values = sorted(values)
+    return values[min(len(values) - 1, len(values) * percent // 100)]
+
+
+class Device:
+    """Sequence numbers received from one device."""
+
+    def __init__(self):
+        self.high = None        # highest sequence number seen
+        self.missing = set()    # below high, not seen yet
+
+    def receive(self, seq):
+        """'new', 'late' (a missing one turned up) or 'duplicate'."""
+        if self.high is None or seq > self.high:
+            if self.high is not None:
+                self.missing.update(range(self.high + 1, seq))
+            self.high = seq
+            return 'new'
+        if seq in self.missing:
+            self.missing.discard(seq)
+            return 'late'
+        return 'duplicate'
+
+
+class Ingest:
+    def __init__(self, delay_ms, drop_responses):
+        self.delay = delay_ms / 1000
+        self.drop_responses = drop_responses
+        self.devices = {}
+        self.started = time.monotonic()
+        self.totals = dict(requests=0, heads=0, events=0, duplicates=0, late=0,
+                           dropped_responses=0, connections=0, open_connections=0)
+        # Since the last report
+        self.service_ms = []
+        self.ages_ms = []
+        self.interval_events = 0
+        self.interval_requests = 0
+
+    def lost(self):
+        return sum(len(d.missing) for d in self.devices.values())
+
+    def stats(self):
+        stats = dict(self.totals)
+        stats['devices'] = len(self.devices)
+        stats['lost'] = self.lost()
+        stats['uptime_s'] = round(time.monotonic() - self.started, 3)
+        return stats
+
+    def ingest(self, device_name, body):
+        device = self.devices.setdefault(device_name, Device())
+        events = parse_batch(body)
+        for seq, age, _ in events:
+            verdict = device.receive(seq)
+            if verdict == 'duplicate':
+                self.totals['duplicates'] += 1
+                continue
+            if verdict == 'late':
+                self.totals['late'] += 1
+            self.totals['events'] += 1
+            self.interval_events += 1
+            if age >= 0:
+                self.ages_ms.append(age)
+        return len(events)
+
+    async def read_request(self, reader):
+        """(method, path, headers, body), or None at the end of the connection."""
+        line = await reader.readline()
+        if not line:
+            return None
+        method, path, _ = line.decode('latin-1').split(' ', 2)
+        headers = {}
+        while True:
+            line = (await reader.readline()).decode('latin-1').strip()
+            if not line:
+                break
+            name, _, value = line.partition(':')
+            headers[name.strip().lower()] = value.strip()
+        length = int(headers.get('content-length', 0))
+        body = await reader.readexactly(length) if length else b''
+        return method, path, headers, body
+
+    async def handle(self, reader, writer):
+        self.totals['connections'] += 1
+        self.totals['open_connections'] += 1
+        try:
+            while True:
+                request = await self.read_request(reader)
+                if request is None:
+                    break
+                method, path, headers, body = request
+                start = time.monotonic()
+                status, content_type, reply = 200, 'text/plain', b''
+                batch = False
+                if method == 'HEAD':
+                    self.totals['heads'] += 1
+                elif method == 'GET' and path == '/tgbl/stats':
+                    content_type = 'application/json'
+                    reply = json.dumps(self.stats()).encode()
+                elif method == 'POST' and path == '/tgbl':
+                    if headers.get('content-type') != 'text/x-tgbl-batch':
+                        status, reply = 415, b'batch expected'
+                    else:
+                        device = headers.get('x-tgbl-device',
+                                             writer.get_extra_info('peername')[0])
+                        self.ingest(device, body.decode('utf-8', 'replace'))
+                        self.totals['requests'] += 1
+                        self.interval_requests += 1
+                        batch = True
+                        reply = b'ok'
+                else:
+                    status, reply = 404, b'not found'
+                if self.delay:
+                    await asyncio.sleep(self.delay)
+                if batch and random.random() < self.drop_responses:
+                    self.totals['dropped_responses'] += 1
+                    break
+                closing = headers.get('connection', '').lower() == 'close'
+                writer.write(('HTTP/1.1 %d %s\r\nContent-Type: %s\r\n'
+                              'Content-Length: %d\r\n%s\r\n' % (
+                                  status, 'OK' if status == 200 else 'Error',
+                                  content_type, len(reply),
+                                  'Connection: close\r\n' if closing else '')).encode())
+                if method != 'HEAD':
+                    writer.write(reply)
+                await writer.drain()
+                if batch:
+                    self.service_ms.append((time.monotonic() - start) * 1000)
+                if closing:
+                    break
+        except (ConnectionError, asyncio.IncompleteReadError, ValueError):
+            pass
+        finally:
+            self.totals['open_connections'] -= 1
+            writer.close()
+
+    async def report(self, interval):
+        while True:
+            await asyncio.sleep(interval)
+            print('[%.0f s] %.0f events/s in %.0f requests/s, %d connections\n'
+                  '       service p50 %.1f p99 %.1f ms, age p50 %d p99 %d ms\n'
+                  '       duplicates %d, lost %d' % (
+                      time.monotonic() - self.started,
+                      self.interval_events / interval, self.interval_requests / interval,
+                      self.totals['open_connections'],
+                      percentile(self.service_ms, 50), percentile(self.service_ms, 99),
+                      percentile(self.ages_ms, 50), percentile(self.ages_ms, 99),
+                      self.totals['duplicates'], self.lost()), flush=True)
+            self.service_ms, self.ages_ms = [], []
+            self.interval_events = self.interval_requests = 0
+
+
+async def serve(args):
+    ingest = Ingest(args.delay_ms, args.drop_responses)
+    server = await asyncio.start_server(ingest.handle, args.host, args.port,
+                                        backlog=1024)
+    print('Listening on %s:%d' % (args.host, args.port), flush=True)
+    async with server:
+        await asyncio.gather(server.serve_forever(), ingest.report(args.report))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--host', default='0.0.0.0')
+    parser.add_argument('--port', type=int, default=80)
+    parser.add_argument('--report', type=float, default=10, metavar='S',
+                        help='summary interval in seconds')
+    parser.add_argument('--delay-ms', type=float, default=0,
+                        help='processing time added to each request')
+    parser.add_argument('--drop-responses', type=float, default=0.0, metavar='P',
+                        help='share of batches accepted but not answered')
+    args = parser.parse_args()
+    # One connection per device
+    _, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+    try:
+        asyncio.run(serve(args))
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+"""Stand-in for the /tgbl message endpoint, to check the firmware client.
+
+Logs every request with the connection it arrived on and how many
+requests that connection has carried, so connection reuse is visible at a
+glance, and then the messages it carries:
+
+    tools/tgbl_server.py --port 80
+    [conn 1 #1] Tangible_01: 2 events  (first on this connection)
+        seq 7 age 3 ms: 'card-42'
+        seq 8 age 0 ms: 'no card'
+
+Requests of type text/x-tgbl-batch carry one message per line, as
+"<seq> <age ms> <message>" with backslash and newline escaped (age -1 if
+unknown). Messages are de-duplicated per X-Tgbl-Device: a sequence number
+already seen is acknowledged but logged as a duplicate, as retries after a
+lost response produce them. Other requests are logged whole.
+
+--close-every N makes the server close each connection after N requests,
+to exercise the client's reconnect path.
+
+--tls CERT KEY serves HTTPS instead (NETWORK_HTTPS), logging each
+handshake with its duration, so the cost of every new connection shows
+up next to connection reuse. HEAD requests, which
+the firmware sends to open the connection ahead of a message, are logged
+and answered empty. A self-signed certificate for a test server:
+
+    openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 \
+        -nodes -days 365 -subj /CN=192.168.1.8 \
+        -addext subjectAltName=IP:192.168.1.8 -keyout key.pem -out cert.pem
+
+and cert.pem as NETWORK_TLS_CA_FILE in the firmware.
+"""
+import argparse
+import http.server
+import itertools
+import ssl
+import threading
+import time
+
+connection_ids = itertools.count(1)
+seen_lock = threading.Lock()
+seen = {}   # device -> set of sequence numbers
+
+
+def unescape(text):
+    out = []
+    chars = iter(text)
+    for c in chars:
+        if c == '\\':
+            c = next(chars, '')
+            c = '\n' if c == 'n' else c
+        out.append(c)
+    return ''.join(out)
+
+
+def parse_batch(body):
+    """(seq, age_ms, message) for each line of a batch body."""
+    events = []
+    for line in body.split('\n'):
+        if not line:
+            continue
+        seq, age, msg = line.split(' ', 2)
+        events.append((int(seq), int(age), unescape(msg)))
+    return events
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'   # keep-alive unless told otherwise
+    close_every = 0
+
+    tls_context = None
+
+    def setup(self):
+        self.conn_id = next(connection_ids)
+        self.requests = 0
+        if self.tls_context:
+            start = time.monotonic()
+            try:
+                self.request = self.tls_context.wrap_socket(self.request, server_side=True)
+            except (ssl.SSLError, OSError) as e:
+                print('[conn %d] TLS handshake failed: %s' % (self.conn_id, e), flush=True)
+                raise
+            print('[conn %d] TLS handshake in %.0f ms, %s' % (
+                self.conn_id, (time.monotonic() - start) * 1000,
+                self.request.version()), flush=True)
+        super().setup()
+
+    def do_HEAD(self):
+        self.requests += 1
+        print('[conn %d #%d] HEAD (connection opened ahead)' % (
+            self.conn_id, self.requests), flush=True)
+        self.send_response(200)
+        self.send_header('Content-Length', '0')
+        self.end_headers()
+
+    def do_POST(self):
+        length = int(self.headers.get('Content-Length', 0))
+        body = self.rfile.read(length).decode('utf-8', 'replace')
+        self.requests += 1
+        note = '  (first on this connection)' if self.requests == 1 else ''
+        device = self.headers.get('X-Tgbl-Device', self.client_address[0])
+        if self.headers.get('Content-Type') != 'text/x-tgbl-batch':
+            print('[conn %d #%d] %s: %r%s' % (self.conn_id, self.requests,
+                                             device, body, note), flush=True)
+        else:
+            events = parse_batch(body)
+            lines = ['[conn %d #%d] %s: %d events%s' % (
+                self.conn_id, self.requests, device, len(events), note)]
+            with seen_lock:
+                known = seen.setdefault(device, set())
+                for seq, age, msg in events:
+                    duplicate = ' DUPLICATE' if seq in known else ''
+                    known.add(seq)
+                    lines.append('    seq %d age %d ms: %r%s' % (seq, age, msg, duplicate))
+            print('\n'.join(lines), flush=True)
+
+        closing = self.close_every and self.requests >= self.close_every
+        self.send_response(200)
+        self.send_header('Content-Type', 'text/plain')
+        self.send_header('Content-Length', '2')
+        if closing:
+            self.send_header('Connection', 'close')
+            self.close_connection = True
+        self.end_headers()
+        self.wfile.write(b'ok')
+
+    def log_message(self, fmt, *args):
+        pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--host', default='0.0.0.0')
+    parser.add_argument('--port', type=int, default=80)
+    parser.add_argument('--close-every', type=int, default=0, metavar='N',
+                        help='close each connection after N requests')
+    parser.add_argument('--tls', nargs=2, metavar=('CERT', 'KEY'),
+                        help='serve HTTPS with this certificate and key')
+    args = parser.parse_args()
+
+    Handler.close_every = args.close_every
+    if args.tls:
+        context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        context.load_cert_chain(*args.tls)
+        Handler.tls_context = context
+    server = http.server.ThreadingHTTPServer((args.host, args.port), Handler)
+    print('Listening on %s:%d%s' % (args.host, args.port,
+                                    ' (TLS)' if args.tls else ''), flush=True)
+    server.serve_forever()
+
+
+if __name__ == '__main__':
+    main()
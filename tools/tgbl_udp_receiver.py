@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""Reference receiver for the UDP message transport (NETWORK_TRANSPORT_UDP).
+
+Acks every well-formed datagram and logs the events it carries, dropping
+events whose sequence number was already seen from that device:
+
+    tools/tgbl_udp_receiver.py --port 7531
+    Tangible_01 192.168.1.23:49153: 2 events
+        seq 7 age 3 ms: 'card-42'
+        seq 8 age 0 ms: 'no card'
+
+--drop P discards a share P (0..1) of incoming datagrams and of acks, to
+exercise the resend path. The datagram layout is described in
+components/network/transport_udp.c.
+"""
+import argparse
+import random
+import socket
+import struct
+
+TYPE_EVENTS = 1
+TYPE_ACK = 2
+
+
+def parse_events(data):
+    """(device, [(seq, age_ms, message)]) of an events datagram, or None."""
+    if len(data) < 5 or data[:2] != b'TG' or data[2] != TYPE_EVENTS:
+        return None
+    name_len = data[3]
+    pos = 4 + name_len
+    device = data[4:pos].decode('utf-8', 'replace')
+    count = data[pos]
+    pos += 1
+    events = []
+    for _ in range(count):
+        seq, age, length = struct.unpack_from('>IiB', data, pos)
+        pos += 9
+        events.append((seq, age, data[pos:pos + length].decode('utf-8', 'replace')))
+        pos += length
+    return device, events
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--host', default='0.0.0.0')
+    parser.add_argument('--port', type=int, default=7531)
+    parser.add_argument('--drop', type=float, default=0.0, metavar='P',
+                        help='share of datagrams and acks to discard')
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.host, args.port))
+    print('Listening on %s:%d' % (args.host, args.port), flush=True)
+    seen = {}   # device -> set of sequence numbers
+
+    while True:
+        data, addr = sock.recvfrom(2048)
+        if random.random() < args.drop:
+            print('(dropped datagram from %s:%d)' % addr, flush=True)
+            continue
+        try:
+            parsed = parse_events(data)
+        except struct.error:
+            parsed = None
+        if not parsed:
+            print('Malformed datagram from %s:%d' % addr, flush=True)
+            continue
+        device, events = parsed
+        known = seen.setdefault(device, set())
+        lines = ['%s %s:%d: %d events' % (device, addr[0], addr[1], len(events))]
+        for seq, age, msg in events:
+            duplicate = ' DUPLICATE' if seq in known else ''
+            known.add(seq)
+            lines.append('    seq %d age %d ms: %r%s' % (seq, age, msg, duplicate))
+        print('\n'.join(lines), flush=True)
+
+        if events and random.random() >= args.drop:
+            sock.sendto(b'TG' + struct.pack('>BIB', TYPE_ACK, events[0][0], len(events)), addr)
+        elif events:
+            print('(dropped ack)', flush=True)
+
+
+if __name__ == '__main__':
+    main()
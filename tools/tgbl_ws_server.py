@@ -0,0 +1,232 @@
+#!/usr/bin/env python3
+"""Stand-in server for the WebSocket transport (NETWORK_TRANSPORT_WEBSOCKET).
+
+Accepts the firmware's WebSocket at /tgbl/ws, acks and logs the events it
+sends, and sends it commands typed on stdin:
+
+    tools/tgbl_ws_server.py --port 8080
+    [conn 1] hello Tangible_01
+    [conn 1] Tangible_01: 1 events
+        seq 7 age 3 ms: 'card-42'
+    set roi off
+    [conn 1] Tangible_01: ok set roi off
+    dump
+    [conn 1] Tangible_01: frame 1, 640x480 -> Tangible_01-1.pgm
+
+A command goes to every connected device, or to one with
+"@<device> <command>". Commands are described in main/remote.h and the
+protocol in components/network/transport_ws.c. As with
+tools/tgbl_server.py, sequence numbers already seen from a device are
+acked but logged as duplicates.
+
+--drop-acks P leaves a share P (0..1) of batches unacknowledged, to
+exercise the firmware's resend path.
+"""
+import argparse
+import base64
+import hashlib
+import itertools
+import random
+import socketserver
+import struct
+import sys
+import threading
+
+WS_GUID = '258EAFA5-E914-47DA-95CA-C5AB0DC85B11'
+OP_CONT, OP_TEXT, OP_BINARY, OP_CLOSE, OP_PING, OP_PONG = 0, 1, 2, 8, 9, 10
+FRAME_HEADER = struct.Struct('>cHHHI')
+
+connection_ids = itertools.count(1)
+clients_lock = threading.Lock()
+clients = {}    # conn id -> Handler
+seen = {}       # device -> set of sequence numbers
+
+
+def unescape(text):
+    out = []
+    chars = iter(text)
+    for c in chars:
+        if c == '\\':
+            c = next(chars, '')
+            c = '\n' if c == 'n' else c
+        out.append(c)
+    return ''.join(out)
+
+
+class Handler(socketserver.StreamRequestHandler):
+    drop_acks = 0.0
+
+    def log(self, text):
+        print('[conn %d] %s' % (self.conn_id, text), flush=True)
+
+    def handshake(self):
+        request = self.rfile.readline().decode('latin-1')
+        headers = {}
+        while True:
+            line = self.rfile.readline().decode('latin-1').strip()
+            if not line:
+                break
+            name, _, value = line.partition(':')
+            headers[name.strip().lower()] = value.strip()
+        key = headers.get('sec-websocket-key')
+        if not request.startswith('GET ') or not key:
+            self.wfile.write(b'HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n')
+            return False
+        accept = base64.b64encode(hashlib.sha1((key + WS_GUID).encode()).digest()).decode()
+        self.wfile.write(('HTTP/1.1 101 Switching Protocols\r\n'
+                          'Upgrade: websocket\r\nConnection: Upgrade\r\n'
+                          'Sec-WebSocket-Accept: %s\r\n\r\n' % accept).encode())
+        return True
+
+    def read_frame(self):
+        """(fin, opcode, payload), or None when the connection is gone."""
+        head = self.rfile.read(2)
+        if len(head) < 2:
+            return None
+        fin, opcode = head[0] & 0x80, head[0] & 0x0f
+        length = head[1] & 0x7f
+        if length == 126:
+            length = struct.unpack('>H', self.rfile.read(2))[0]
+        elif length == 127:
+            length = struct.unpack('>Q', self.rfile.read(8))[0]
+        mask = self.rfile.read(4) if head[1] & 0x80 else b'\0\0\0\0'
+        data = bytearray(self.rfile.read(length))
+        for i in range(len(data)):
+            data[i] ^= mask[i % 4]
+        return fin, opcode, bytes(data)
+
+    def send(self, opcode, payload):
+        head = bytes([0x80 | opcode])
+        if len(payload) < 126:
+            head += bytes([len(payload)])
+        elif len(payload) < 65536:
+            head += bytes([126]) + struct.pack('>H', len(payload))
+        else:
+            head += bytes([127]) + struct.pack('>Q', len(payload))
+        with self.send_lock:
+            self.wfile.write(head + payload)
+
+    def send_text(self, text):
+        self.send(OP_TEXT, text.encode())
+
+    def on_text(self, text):
+        if text.startswith('hello '):
+            self.device = text[6:]
+            self.log(text)
+            return
+        if text.startswith(('ok ', 'err ')):
+            self.log('%s: %s' % (self.device, text))
+            return
+        events = []
+        for line in text.split('\n'):
+            if line:
+                seq, age, msg = line.split(' ', 2)
+                events.append((int(seq), int(age), unescape(msg)))
+        if not events:
+            return
+        lines = ['%s: %d events' % (self.device, len(events))]
+        with clients_lock:
+            known = seen.setdefault(self.device, set())
+            for seq, age, msg in events:
+                duplicate = ' DUPLICATE' if seq in known else ''
+                known.add(seq)
+                lines.append('    seq %d age %d ms: %r%s' % (seq, age, msg, duplicate))
+        self.log('\n'.join(lines))
+        if random.random() < self.drop_acks:
+            self.log('(ack dropped)')
+        else:
+            self.send_text('ack %d %d' % (events[0][0], len(events)))
+
+    def on_binary(self, data):
+        if len(data) < FRAME_HEADER.size or data[:1] != b'F':
+            self.log('Unknown binary message of %d bytes' % len(data))
+            return
+        _, number, width, height, offset = FRAME_HEADER.unpack_from(data)
+        if offset == 0:
+            self.frame = bytearray(width * height)
+        pixels = data[FRAME_HEADER.size:]
+        self.frame[offset:offset + len(pixels)] = pixels
+        if offset + len(pixels) >= width * height:
+            name = '%s-%d.pgm' % (self.device, number)
+            with open(name, 'wb') as f:
+                f.write(b'P5\n%d %d\n255\n' % (width, height))
+                f.write(self.frame)
+            self.log('%s: frame %d, %dx%d -> %s' % (self.device, number, width, height, name))
+
+    def handle(self):
+        self.conn_id = next(connection_ids)
+        self.device = self.client_address[0]
+        self.send_lock = threading.Lock()
+        self.frame = bytearray()
+        if not self.handshake():
+            return
+        with clients_lock:
+            clients[self.conn_id] = self
+        message, message_op = b'', None
+        try:
+            while True:
+                frame = self.read_frame()
+                if frame is None:
+                    break
+                fin, opcode, payload = frame
+                if opcode == OP_CLOSE:
+                    self.send(OP_CLOSE, payload[:2])
+                    break
+                if opcode == OP_PING:
+                    self.send(OP_PONG, payload)
+                    continue
+                if opcode != OP_CONT:
+                    message, message_op = b'', opcode
+                message += payload
+                if not fin:
+                    continue
+                if message_op == OP_TEXT:
+                    self.on_text(message.decode('utf-8', 'replace'))
+                elif message_op == OP_BINARY:
+                    self.on_binary(message)
+        except (ConnectionError, struct.error):
+            pass
+        finally:
+            with clients_lock:
+                clients.pop(self.conn_id, None)
+            self.log('closed')
+
+
+def console():
+    for line in sys.stdin:
+        line = line.strip()
+        if not line:
+            continue
+        target = None
+        if line.startswith('@'):
+            target, _, line = line[1:].partition(' ')
+        with clients_lock:
+            handlers = [h for h in clients.values() if target in (None, h.device)]
+        if not handlers:
+            print('No device connected' + (' as ' + target if target else ''), flush=True)
+        for handler in handlers:
+            try:
+                handler.send_text(line)
+            except OSError:
+                pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--host', default='0.0.0.0')
+    parser.add_argument('--port', type=int, default=80)
+    parser.add_argument('--drop-acks', type=float, default=0.0, metavar='P',
+                        help='share of batches to leave unacknowledged')
+    args = parser.parse_args()
+
+    Handler.drop_acks = args.drop_acks
+    socketserver.ThreadingTCPServer.allow_reuse_address = True
+    socketserver.ThreadingTCPServer.daemon_threads = True
+    server = socketserver.ThreadingTCPServer((args.host, args.port), Handler)
+    threading.Thread(target=console, daemon=True).start()
+    print('Listening on %s:%d' % (args.host, args.port), flush=True)
+    server.serve_forever()
+
+
+if __name__ == '__main__':
+    main()